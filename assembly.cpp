@@ -0,0 +1,119 @@
+#include "assembly.hh"
+#include <cctype>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+assembly::~assembly()
+{
+    unmap();
+}
+
+void assembly::unmap()
+{
+    if (mapping)
+        munmap(mapping, length);
+    mapping = nullptr;
+    length = position = 0;
+}
+
+void assembly::clear()
+{
+    unmap();
+    words.clear();
+    lines.assign(1, line{std::string_view(), 0, 0, true});
+}
+
+void assembly::swap(assembly &other)
+{
+    std::swap(mapping, other.mapping);
+    std::swap(length, other.length);
+    std::swap(position, other.position);
+    lines.swap(other.lines);
+    words.swap(other.words);
+}
+
+bool assembly::map(std::string fileName)
+{
+    clear();
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat status;
+    bool mapped = fstat(file, &status) == 0;
+    // An empty file has nothing to map and no lines
+    if (mapped && status.st_size > 0)
+    {
+        mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping == MAP_FAILED)
+        {
+            mapping = nullptr;
+            mapped = false;
+        }
+        else
+        {
+            length = status.st_size;
+            madvise(mapping, length, MADV_SEQUENTIAL);
+        }
+    }
+    close(file);
+    return mapped;
+}
+
+bool assembly::nextLine(std::string_view &line)
+{
+    if (position >= length)
+        return false;
+    const char *text = (const char *)mapping;
+    const char *newline = (const char *)memchr(text + position, '\n', length - position);
+    size_t end = newline ? newline - text : length;
+    line = std::string_view(text + position, end - position);
+    position = end + 1;
+
+    size_t comment = line.find(';');
+    if (comment != std::string_view::npos)
+        line = line.substr(0, comment);
+    size_t first = line.find_first_not_of(' ');
+    if (first == std::string_view::npos)
+        line = std::string_view();
+    else
+        line = line.substr(first, line.find_last_not_of(' ') - first + 1);
+    return true;
+}
+
+u_int64_t assembly::hash(std::string_view file)
+{
+    // FNV-1a over 8 byte words, with the high half folded back in so that
+    // every byte reaches every bit
+    u_int64_t value = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= file.size(); i += 8)
+    {
+        u_int64_t word;
+        memcpy(&word, file.data() + i, 8);
+        value = (value ^ word) * 1099511628211ULL;
+        value ^= value >> 32;
+    }
+    for (; i < file.size(); i++)
+        value = (value ^ (u_int8_t)file[i]) * 1099511628211ULL;
+    return value;
+}
+
+void assembly::split(std::string_view text, std::vector<std::string_view> &tokens)
+{
+    size_t i = 0;
+    while (true)
+    {
+        while (i < text.size() && (isspace((unsigned char)text[i]) || text[i] == ','))
+            i++;
+        if (i == text.size())
+            return;
+        size_t start = i;
+        while (i < text.size() && !isspace((unsigned char)text[i]) && text[i] != ',')
+            i++;
+        tokens.push_back(text.substr(start, i - start));
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef ASSEMBLY_GUARD
+#define ASSEMBLY_GUARD
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+
+// An assembly file mapped into memory. Lines are read in place and the tokens
+// kept for each line are views into the mapping, so loading copies none of
+// the text. A line is split into tokens the first time they are asked for.
+// The views stay valid until the next clear or map.
+class assembly
+{
+public:
+    // The tokens of one line. Indices past the end read as empty tokens.
+    class tokens
+    {
+    private:
+        const std::string_view *first;
+        size_t count;
+
+    public:
+        tokens(const std::string_view *first, size_t count) : first(first), count(count) {}
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        std::string_view operator[](size_t i) const
+        {
+            return i < count ? first[i] : std::string_view();
+        }
+    };
+
+private:
+    void *mapping;
+    size_t length;
+    size_t position;
+    struct line
+    {
+        // The part of the line that holds the instruction
+        std::string_view text;
+        // Where its tokens are in words once split is set
+        size_t first;
+        size_t count;
+        bool split;
+    };
+    // Lines are split on demand, which does not change what they hold
+    mutable std::vector<line> lines;
+    mutable std::vector<std::string_view> words;
+
+    void unmap();
+
+public:
+    assembly()
+    {
+        mapping = nullptr;
+        length = 0;
+        clear();
+    }
+
+    ~assembly();
+
+    assembly(const assembly &) = delete;
+
+    assembly &operator=(const assembly &) = delete;
+
+    // Drops the file and every line but the empty line 0
+    void clear();
+
+    void swap(assembly &other);
+
+    bool map(std::string fileName);
+
+    // The next line of the file without its comment and surrounding spaces,
+    // false at the end of the file
+    bool nextLine(std::string_view &line);
+
+    // Stores text as the instruction part of the next line
+    void addLine(std::string_view text)
+    {
+        lines.push_back({text, 0, 0, false});
+    }
+
+    void reserve(size_t count)
+    {
+        lines.reserve(count);
+    }
+
+    std::string_view lineText(size_t number) const
+    {
+        return lines[number].text;
+    }
+
+    // The whole file
+    std::string_view text() const
+    {
+        return std::string_view((const char *)mapping, length);
+    }
+
+    // Hash of the whole file, to tell whether it changed
+    u_int64_t hash() const
+    {
+        return hash(text());
+    }
+
+    static u_int64_t hash(std::string_view text);
+
+    // Splits text at whitespace and commas
+    static void split(std::string_view text, std::vector<std::string_view> &tokens);
+
+    size_t size() const
+    {
+        return lines.size();
+    }
+
+    tokens operator[](size_t number) const
+    {
+        const line &l = lines[number];
+        if (!l.split)
+        {
+            lines[number].first = words.size();
+            split(l.text, words);
+            lines[number].count = words.size() - l.first;
+            lines[number].split = true;
+        }
+        return tokens(words.data() + l.first, l.count);
+    }
+};
+
+#endif
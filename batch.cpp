@@ -0,0 +1,139 @@
+#include "batch.hh"
+#include "simulator.hh"
+#include "utilities.hh"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <sstream>
+
+namespace
+{
+    struct job
+    {
+        std::string description;
+        std::string fileName;
+        std::string cacheConfig;
+        long long limit;
+        simulator::executionMode mode;
+        std::string error;
+        std::string output;
+    };
+
+    job parse(std::string line)
+    {
+        job j;
+        j.description = line;
+        j.limit = 0;
+        j.mode = simulator::DECODED;
+
+        std::stringstream ss(line);
+        ss >> j.fileName;
+        std::string option;
+        while (ss >> option)
+        {
+            std::string key = option.substr(0, option.find('=')), value = option.substr(key.size() + (key.size() < option.size()));
+            if (key == "cache" && !value.empty())
+                j.cacheConfig = value;
+            else if (key == "limit" && !value.empty() && utilities::checkBase10(value) && value.size() < 19)
+                j.limit = stoll(value);
+            else if (key == "mode" && value == "decoded")
+                j.mode = simulator::DECODED;
+            else if (key == "mode" && value == "binary")
+                j.mode = simulator::BINARY;
+            else if (key == "mode" && value == "block")
+                j.mode = simulator::BLOCK;
+            else if (key == "mode" && value == "jit")
+                j.mode = simulator::JIT;
+            else
+                j.error = "Invalid option: " + option;
+        }
+        return j;
+    }
+
+    void execute(job &j, int number)
+    {
+        if (!j.error.empty())
+            return;
+        if (!std::ifstream(j.fileName))
+        {
+            j.error = "Cannot open " + j.fileName;
+            return;
+        }
+        if (!j.cacheConfig.empty() && !std::ifstream(j.cacheConfig))
+        {
+            j.error = "Cannot open " + j.cacheConfig;
+            return;
+        }
+
+        std::ostringstream out;
+        simulator sim;
+        sim.setOutput(out, out);
+        // Jobs may share a source file, so each one logs cache accesses to its own file
+        sim.setOutputName(j.fileName.substr(0, j.fileName.rfind('.')) + ".job" + std::to_string(number) + ".output");
+        if (!j.cacheConfig.empty())
+            sim.enableCache(j.cacheConfig);
+        sim.setExecutionMode(j.mode);
+        sim.setInstructionLimit(j.limit);
+        sim.load(j.fileName);
+        // The errors themselves are already in the output
+        if (!sim.getErrors().empty())
+        {
+            j.error = "Cannot assemble " + j.fileName;
+            j.output = out.str();
+            return;
+        }
+        sim.run(false, true, -1);
+        sim.printRegisters();
+        j.output = out.str();
+    }
+}
+
+int batch::run(std::string jobsFile, int threads)
+{
+    std::ifstream input(jobsFile);
+    if (!input)
+    {
+        std::cerr << "Cannot open " << jobsFile << std::endl;
+        return 1;
+    }
+    std::vector<job> jobs;
+    std::string line;
+    while (getline(input, line))
+    {
+        std::string first;
+        std::stringstream(line) >> first;
+        if (!first.empty() && first[0] != '#')
+            jobs.push_back(parse(line));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back([&jobs, &next]()
+                             {
+                                 for (size_t k = next++; k < jobs.size(); k = next++)
+                                     execute(jobs[k], k + 1);
+                             });
+    for (auto &worker : workers)
+        worker.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::string resultsFile = jobsFile.substr(0, jobsFile.rfind('.')) + ".results";
+    std::ofstream results(resultsFile);
+    int failed = 0;
+    for (size_t k = 0; k < jobs.size(); k++)
+    {
+        results << "Job " << k + 1 << ": " << jobs[k].description << std::endl;
+        if (!jobs[k].error.empty())
+        {
+            results << jobs[k].error << std::endl;
+            failed++;
+        }
+        results << jobs[k].output;
+    }
+    results.close();
+
+    std::cout << "Ran " << jobs.size() << " jobs (" << failed << " failed) on " << threads << " threads in " << seconds << " s, results in " << resultsFile << std::endl;
+    return failed ? 1 : 0;
+}
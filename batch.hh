@@ -0,0 +1,16 @@
+#ifndef BATCH_GUARD
+#define BATCH_GUARD
+
+#include <string>
+
+namespace batch
+{
+    // Runs every job in jobsFile on its own simulator, threads at a time, and
+    // writes what each job printed, in job order, to the results file next to
+    // jobsFile. A job is one line:
+    //     <file.s> [cache=<config>] [limit=<count>] [mode=<decoded|binary|block|jit>]
+    // Empty lines and lines starting with # are skipped.
+    int run(std::string jobsFile, int threads);
+}
+
+#endif
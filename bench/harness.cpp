@@ -0,0 +1,250 @@
+// Throughput of the simulator on the kernels named on the command line.
+//     harness [-r <repeats>] <kernel.s>...
+// Every kernel runs in a child process of its own, so the peak RSS reported
+// for it is its own, and each measurement is one tab separated line
+//     <kernel> <measurement> <value> <unit>
+// in a fixed order, so the output of two builds can be put side by side
+// with diff or join. Speeds are the best of the repeats.
+#include "simulator.hh"
+#include "utilities.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+namespace
+{
+    // Runs with the cache simulator log every access, so they stop here
+    const long long cacheLimit = 2000000;
+    // Lines of the generated source that measures the assembler, and the
+    // memory its text needs
+    const int assemblerLines = 200000;
+    const long long assemblerMemory = 1LL << 24;
+
+    const char *modes[] = {"decoded", "binary", "block", "jit"};
+    const char *replacementPolicies[] = {"FIFO", "LRU", "RANDOM"};
+    const char *writePolicies[] = {"WB", "WT"};
+
+    std::string kernelName(std::string fileName)
+    {
+        size_t slash = fileName.rfind('/');
+        fileName = fileName.substr(slash == std::string::npos ? 0 : slash + 1);
+        return fileName.substr(0, fileName.rfind('.'));
+    }
+
+    void report(std::string kernel, std::string measurement, double value, std::string unit)
+    {
+        // Counts are printed whole, times and speeds to six digits
+        std::ostringstream line;
+        line << kernel << '\t' << measurement << '\t';
+        if (value == (long long)value)
+            line << (long long)value;
+        else
+            line << value;
+        line << '\t' << unit << '\n';
+        std::cout << line.str() << std::flush;
+    }
+
+    double counter(simulator &sim, std::string name)
+    {
+        for (auto &c : sim.getCounters())
+            if (c.first == name)
+                return c.second;
+        return 0;
+    }
+
+    // Loads source on a fresh simulator and runs it, false if it has errors
+    bool measure(std::string source, std::string cacheConfig, simulator::executionMode mode, double &assembleSeconds, double &mips, long long &retired)
+    {
+        simulator sim;
+        sim.discardOutput();
+        sim.setOutputName("/dev/null");
+        sim.setExecutionMode(mode);
+        if (!cacheConfig.empty())
+        {
+            sim.enableCache(cacheConfig);
+            sim.setInstructionLimit(cacheLimit);
+        }
+        sim.load(source);
+        if (!sim.getErrors().empty())
+            return false;
+        assembleSeconds = counter(sim, "time.assemble");
+        sim.run(false, true, -1);
+        mips = counter(sim, "mips");
+        retired = sim.getRetired();
+        return true;
+    }
+
+    std::string objectName(std::string source)
+    {
+        return source.substr(0, source.rfind('.')) + ".obj";
+    }
+
+    void benchmark(std::string kernel, std::string source, std::string directory, int repeats)
+    {
+        double assembleSeconds, cachedSeconds, mips;
+        long long retired;
+
+        // Without an object file the source is assembled, with one it is read back
+        double best = 0, bestCached = 0;
+        for (int i = 0; i < repeats; i++)
+        {
+            unlink(objectName(source).c_str());
+            if (!measure(source, "", simulator::DECODED, assembleSeconds, mips, retired))
+            {
+                report(kernel, "error", 1, "-");
+                return;
+            }
+            measure(source, "", simulator::DECODED, cachedSeconds, mips, retired);
+            best = i ? std::min(best, assembleSeconds) : assembleSeconds;
+            bestCached = i ? std::min(bestCached, cachedSeconds) : cachedSeconds;
+        }
+        report(kernel, "instructions", retired, "count");
+        report(kernel, "assemble", best, "s");
+        report(kernel, "assemble-cached", bestCached, "s");
+
+        for (int m = 0; m < 4; m++)
+        {
+            best = 0;
+            for (int i = 0; i < repeats; i++)
+            {
+                measure(source, "", (simulator::executionMode)m, assembleSeconds, mips, retired);
+                best = std::max(best, mips);
+            }
+            report(kernel, modes[m], best, "MIPS");
+        }
+
+        // A 32 KiB, 8-way cache with 64 byte blocks under every policy
+        for (const char *replacement : replacementPolicies)
+            for (const char *write : writePolicies)
+            {
+                std::string name = std::string("cache-") + replacement + "-" + write;
+                std::string config = directory + "/" + name + ".cfg";
+                std::ofstream(config) << "32768 64 8 " << replacement << ' ' << write << std::endl;
+                best = 0;
+                for (int i = 0; i < repeats; i++)
+                {
+                    measure(source, config, simulator::DECODED, assembleSeconds, mips, retired);
+                    best = std::max(best, mips);
+                }
+                unlink(config.c_str());
+                report(kernel, name, best, "MIPS");
+            }
+    }
+
+    // A long source of the usual kinds of instruction line, for the assembler
+    // on its own. Its text runs past where data would start, so it has none.
+    void writeAssemblerSource(std::string fileName)
+    {
+        std::ofstream source(fileName);
+        for (int i = 0; i < assemblerLines / 8; i++)
+            source << "L" << i << ": addi x5, x5, " << i % 2048 << "\n"
+                   << "    add x6, x5, x7\n"
+                   << "    ld x7, 8(x8)\n"
+                   << "    sd x6, 16(sp)\n"
+                   << "    slli x9, x6, 3 ; a comment\n"
+                   << "    lui x10, 0x10\n"
+                   << "    bne x5, x0, L" << (i + 1) % (assemblerLines / 8) << "\n"
+                   << "    jal x0, L" << i << "\n";
+    }
+
+    // Runs what in a child and reports the child's peak RSS under kernel
+    template <typename Work>
+    void inChild(std::string kernel, Work what)
+    {
+        std::cout << std::flush;
+        pid_t child = fork();
+        if (child == 0)
+        {
+            what();
+            std::cout << std::flush;
+            _exit(0);
+        }
+        int status;
+        struct rusage usage;
+        if (child > 0 && wait4(child, &status, 0, &usage) == child)
+            report(kernel, "peak-rss", usage.ru_maxrss, "KiB");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int repeats = 3;
+    std::vector<std::string> kernels;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "-r" && i + 1 < argc && utilities::checkBase10(argv[i + 1]) && atoi(argv[i + 1]) > 0)
+            repeats = atoi(argv[++i]);
+        else
+            kernels.push_back(option);
+    }
+    if (kernels.empty())
+    {
+        std::cerr << "Usage: harness [-r <repeats>] <kernel.s>..." << std::endl;
+        return 1;
+    }
+
+    // Kernels are copied to a directory of their own, as loading writes an
+    // object file next to the source
+    char directory[] = "/tmp/riscv_bench.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        std::cerr << "Cannot create a directory for the kernels" << std::endl;
+        return 1;
+    }
+
+    std::cout << "# kernel\tmeasurement\tvalue\tunit" << std::endl;
+    for (std::string fileName : kernels)
+    {
+        std::string kernel = kernelName(fileName), source = std::string(directory) + "/" + kernel + ".s";
+        std::ifstream input(fileName);
+        if (!input)
+        {
+            report(kernel, "error", 1, "-");
+            continue;
+        }
+        std::ofstream(source) << input.rdbuf();
+        inChild(kernel, [&]() { benchmark(kernel, source, directory, repeats); });
+        unlink(source.c_str());
+        unlink(objectName(source).c_str());
+    }
+
+    std::string source = std::string(directory) + "/assembler.s";
+    writeAssemblerSource(source);
+    inChild("assembler", [&]() {
+        double best = 0, bestCached = 0;
+        simulator sim;
+        sim.discardOutput();
+        sim.setOutputName("/dev/null");
+        sim.setMemorySize(assemblerMemory);
+        for (int i = 0; i < repeats; i++)
+        {
+            unlink(objectName(source).c_str());
+            sim.load(source);
+            if (!sim.getErrors().empty())
+            {
+                report("assembler", "error", 1, "-");
+                return;
+            }
+            double assembleSeconds = counter(sim, "time.assemble");
+            sim.load(source);
+            double cachedSeconds = counter(sim, "time.assemble");
+            best = i ? std::min(best, assembleSeconds) : assembleSeconds;
+            bestCached = i ? std::min(bestCached, cachedSeconds) : cachedSeconds;
+        }
+        report("assembler", "lines", assemblerLines, "count");
+        report("assembler", "assemble", best, "s");
+        report("assembler", "assemble-cached", bestCached, "s");
+    });
+    unlink(source.c_str());
+    unlink(objectName(source).c_str());
+    rmdir(directory);
+    return 0;
+}
@@ -0,0 +1,14 @@
+; Tight integer loop: eight ALU operations and a branch per iteration, no memory
+main: lui x5, 0x200
+      addi x6, x0, 1
+      addi x7, x0, 0
+      addi x11, x0, 0
+loop: add x7, x7, x6
+      xor x8, x7, x5
+      slli x9, x8, 3
+      srli x10, x9, 1
+      sub x6, x10, x7
+      andi x6, x6, 255
+      or x11, x11, x6
+      addi x5, x5, -1
+      bne x5, x0, loop
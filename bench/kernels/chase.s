@@ -0,0 +1,24 @@
+; Follows a linked list of 16384 nodes spread over 128 KiB in a scattered
+; order, one dependent load after another
+main:  lui s0, 0x10
+       lui s1, 0x4
+       addi s2, s1, -1
+       lui s3, 0x1
+       addi s3, s3, 3
+       addi t0, x0, 0
+       addi t5, s1, 0
+build: add t1, t0, s3
+       and t1, t1, s2
+       slli t2, t0, 3
+       add t2, t2, s0
+       slli t3, t1, 3
+       add t3, t3, s0
+       sd t3, 0(t2)
+       addi t0, t1, 0
+       addi t5, t5, -1
+       bne t5, x0, build
+       lui t5, 0x200
+       addi a0, s0, 0
+chase: ld a0, 0(a0)
+       addi t5, t5, -1
+       bne t5, x0, chase
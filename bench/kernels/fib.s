@@ -0,0 +1,22 @@
+; Naive recursive Fibonacci of 27: about 630000 calls and returns
+main: lui sp, 0x50
+      addi a0, x0, 27
+      jal ra, fib
+      beq x0, x0, done
+fib:  addi t0, x0, 2
+      blt a0, t0, leaf
+      addi sp, sp, -24
+      sd ra, 16(sp)
+      sd a0, 8(sp)
+      addi a0, a0, -1
+      jal ra, fib
+      sd a0, 0(sp)
+      ld a0, 8(sp)
+      addi a0, a0, -2
+      jal ra, fib
+      ld t1, 0(sp)
+      add a0, a0, t1
+      ld ra, 16(sp)
+      addi sp, sp, 24
+leaf: jalr x0, 0(ra)
+done: add x0, x0, x0
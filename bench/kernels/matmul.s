@@ -0,0 +1,46 @@
+; C = A * B for 32 x 32 matrices of doublewords, four times over. RV64I has
+; no multiply, so each product is a shift and add loop.
+main: lui s0, 0x10
+      lui s1, 0x12
+      lui s2, 0x14
+      lui s6, 0x2
+      addi t0, x0, 0
+fill: srli t2, t0, 3
+      andi t3, t2, 7
+      addi t3, t3, 1
+      add t4, s0, t0
+      sd t3, 0(t4)
+      andi t3, t2, 3
+      add t4, s1, t0
+      sd t3, 0(t4)
+      addi t0, t0, 8
+      bne t0, s6, fill
+      addi s3, x0, 4
+      addi s7, x0, 256
+rep:  addi s4, x0, 0
+row:  addi s5, x0, 0
+col:  add a1, s0, s4
+      add a2, s1, s5
+      addi a3, x0, 32
+      addi a0, x0, 0
+dot:  ld t0, 0(a1)
+      ld t1, 0(a2)
+mul:  andi t2, t1, 1
+      beq t2, x0, next
+      add a0, a0, t0
+next: slli t0, t0, 1
+      srli t1, t1, 1
+      bne t1, x0, mul
+      addi a1, a1, 8
+      addi a2, a2, 256
+      addi a3, a3, -1
+      bne a3, x0, dot
+      add t3, s2, s4
+      add t3, t3, s5
+      sd a0, 0(t3)
+      addi s5, s5, 8
+      bne s5, s7, col
+      addi s4, s4, 256
+      bne s4, s6, row
+      addi s3, s3, -1
+      bne s3, x0, rep
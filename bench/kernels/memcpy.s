@@ -0,0 +1,20 @@
+; Copies 64 KiB from 0x10000 to 0x20000 a doubleword at a time, 64 times over
+main: lui s0, 0x10
+      lui s1, 0x20
+      lui s2, 0x10
+      addi t0, x0, 0
+fill: add t1, s0, t0
+      sd t0, 0(t1)
+      addi t0, t0, 8
+      bne t0, s2, fill
+      addi s3, x0, 64
+pass: addi a0, s0, 0
+      addi a1, s1, 0
+      add a2, s0, s2
+copy: ld t0, 0(a0)
+      sd t0, 0(a1)
+      addi a0, a0, 8
+      addi a1, a1, 8
+      bne a0, a2, copy
+      addi s3, s3, -1
+      bne s3, x0, pass
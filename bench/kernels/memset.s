@@ -0,0 +1,12 @@
+; Sets 128 KiB from 0x10000 to a pattern a doubleword at a time, 64 times over
+main: lui s0, 0x10
+      lui s1, 0x30
+      addi s3, x0, 64
+      addi t1, x0, -1
+pass: addi a0, s0, 0
+set:  sd t1, 0(a0)
+      addi a0, a0, 8
+      bne a0, s1, set
+      srli t1, t1, 1
+      addi s3, s3, -1
+      bne s3, x0, pass
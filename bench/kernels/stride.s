@@ -0,0 +1,21 @@
+; Reads every doubleword of 128 KiB with strides of 8, 64, 512 and 4096
+; bytes, eight passes each, so only the access pattern changes
+main:   lui s0, 0x10
+        lui s1, 0x20
+        add s4, s0, s1
+        addi s2, x0, 8
+        addi s6, x0, 0
+        lui s7, 0x8
+stride: addi s3, x0, 8
+pass:   addi t0, x0, 0
+start:  add t1, s0, t0
+walk:   ld t3, 0(t1)
+        add s6, s6, t3
+        add t1, t1, s2
+        blt t1, s4, walk
+        addi t0, t0, 8
+        blt t0, s2, start
+        addi s3, s3, -1
+        bne s3, x0, pass
+        slli s2, s2, 3
+        blt s2, s7, stride
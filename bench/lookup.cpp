@@ -0,0 +1,64 @@
+// Cost of a mnemonic or register name lookup: std::map with std::string keys
+// as the assembler used to do, the same map searched with string_view, and
+// the perfect hash tables in mnemonics.hh.
+// make bench runs it after the harness.
+#include "mnemonics.hh"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const int rounds = 200000;
+
+    template <typename Lookup>
+    void measure(std::string name, const std::vector<std::string> &tokens, Lookup lookup)
+    {
+        long long found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++)
+            for (const std::string &token : tokens)
+                found += lookup(token);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << ": " << seconds * 1e9 / ((double)rounds * tokens.size()) << " ns per lookup (" << found << ")" << std::endl;
+    }
+}
+
+int main()
+{
+    std::map<std::string, mnemonics::info> instructionMap;
+    std::map<std::string, mnemonics::info, std::less<>> instructionViewMap;
+    for (auto &e : mnemonics::instructions)
+    {
+        instructionMap[std::string(e.name)] = e.value;
+        instructionViewMap[std::string(e.name)] = e.value;
+    }
+    std::map<std::string, int> registerMap;
+    std::map<std::string, int, std::less<>> registerViewMap;
+    for (auto &e : mnemonics::registers)
+    {
+        registerMap[std::string(e.name)] = e.value;
+        registerViewMap[std::string(e.name)] = e.value;
+    }
+
+    // Tokens as they come out of a source line, a few of them unknown
+    std::vector<std::string> instructionTokens = {"addi", "ld", "sd", "beq", "add", "jal", "lui", "sltiu", "srai", "bgeu", "mul", "nop"};
+    std::vector<std::string> registerTokens = {"x5", "sp", "a0", "x31", "ra", "t6", "s11", "x12", "zero", "fp", "x32", "r1"};
+
+    measure("Mnemonic, std::map<std::string>", instructionTokens, [&](const std::string &s)
+            { return instructionMap.find(s) != instructionMap.end(); });
+    measure("Mnemonic, std::map<std::string, std::less<>> with string_view", instructionTokens, [&](std::string_view s)
+            { return instructionViewMap.find(s) != instructionViewMap.end(); });
+    measure("Mnemonic, perfect hash", instructionTokens, [&](std::string_view s)
+            { return mnemonics::findInstruction(s) != nullptr; });
+
+    measure("Register, std::map<std::string>", registerTokens, [&](const std::string &s)
+            { return registerMap.find(s) != registerMap.end(); });
+    measure("Register, std::map<std::string, std::less<>> with string_view", registerTokens, [&](std::string_view s)
+            { return registerViewMap.find(s) != registerViewMap.end(); });
+    measure("Register, perfect hash", registerTokens, [&](std::string_view s)
+            { return mnemonics::findRegister(s) >= 0; });
+}
@@ -2,7 +2,6 @@
 #include "string"
 #include "fstream"
 #include "vector"
-#include <cstdlib>
 
 CACHE::CACHE(int cacheSize, int blockSize, int associativity, std::string replacementPolicy, std::string writePolicy)
 {
@@ -27,161 +26,219 @@ CACHE::CACHE(int cacheSize, int blockSize, int associativity, std::string replac
         this->associativity = cacheSize / blockSize;
     else
         this->associativity = associativity;
-    this->noOfLines = cacheSize / (blockSize * associativity);
+    this->noOfLines = cacheSize / (blockSize * this->associativity);
+    this->setBits = std::log2(noOfLines);
+    this->setMask = noOfLines - 1;
+    this->setsArePowerOfTwo = (noOfLines & setMask) == 0;
     this->timeCounter = this->hits = this->misses = 0;
+    this->reads = this->writes = this->evictions = this->writebacks = 0;
+    this->misaligned = this->crossings = 0;
 
-    for (int i = 0; i < noOfLines; i++)
-    {
-        table.push_back(std::vector<line>{});
-        for (int j = 0; j < associativity; j++)
-        {
-            table[i].push_back(line{});
-            for (int k = 0; k < blockSize; k++)
-                table[i][j].block.push_back(0);
-        }
-    }
+    size_t count = (size_t)noOfLines * this->associativity;
+    tags.assign(count, 0);
+    RPdata.assign(count, 0);
+    valid.assign(count, false);
+    dirty.assign(count, false);
+    blocks.assign(count * blockSize, 0);
 }
 
-int CACHE::findVictim(int hashValue)
+// Copies configuration, contents and statistics, but not the output file
+CACHE::CACHE(const CACHE &other)
 {
+    restore(other);
+}
+
+void CACHE::restore(const CACHE &other)
+{
+    RP = other.RP;
+    WP = other.WP;
+    timeCounter = other.timeCounter;
+    misses = other.misses;
+    hits = other.hits;
+    reads = other.reads;
+    writes = other.writes;
+    evictions = other.evictions;
+    writebacks = other.writebacks;
+    misaligned = other.misaligned;
+    crossings = other.crossings;
+    cacheSize = other.cacheSize;
+    noOfLines = other.noOfLines;
+    associativity = other.associativity;
+    blockSize = other.blockSize;
+    blockOffset = other.blockOffset;
+    setBits = other.setBits;
+    setMask = other.setMask;
+    setsArePowerOfTwo = other.setsArePowerOfTwo;
+    tags = other.tags;
+    RPdata = other.RPdata;
+    valid = other.valid;
+    dirty = other.dirty;
+    blocks = other.blocks;
+    random = other.random;
+}
+
+int CACHE::findVictim(int set)
+{
+    int first = set * associativity;
     if (RP == RANDOM)
-        return std::rand() % associativity;
+        return first + random() % associativity;
 
-    int index, hold = INT32_MAX;
-    for (int i = 0; i < table[hashValue].size(); i++)
-        if (!table[hashValue][i].valid)
+    int index = first;
+    long long hold = LLONG_MAX;
+    for (int i = first; i < first + associativity; i++)
+        if (!valid[i])
             return i;
-        else if (table[hashValue][i].RPdata < hold)
+        else if (RPdata[i] < hold)
         {
-            hold = table[hashValue][i].RPdata;
+            hold = RPdata[i];
             index = i;
         }
     return index;
 }
 
-int CACHE::checkHitOrMiss(int hashValue, int tag)
+int CACHE::checkHitOrMiss(int set, long long tag)
 {
-    for (int i = 0; i < table[hashValue].size(); i++)
-        if (table[hashValue][i].valid && table[hashValue][i].tag == tag)
+    int first = set * associativity;
+    for (int i = first; i < first + associativity; i++)
+        if (tags[i] == tag && valid[i])
             return i;
     return -1;
 }
 
-long long CACHE::read(simulator &sim, int address, int size, bool isSigned)
+void CACHE::writeBack(simulator &sim, int index, int set)
+{
+    if (!valid[index] || !dirty[index])
+        return;
+    writebacks++;
+    sim.ram.write(blockAddress(index, set), blockOf(index), blockSize);
+}
+
+long long CACHE::read(simulator &sim, long long address, int size, bool isSigned)
+{
+    reads++;
+    if (address & (size / 8 - 1))
+        misaligned++;
+    int first = blockSize - address % blockSize;
+    if (size / 8 <= first)
+        return memory::extend(readBlock(sim, address, size), size, isSigned);
+
+    // The bytes that fall in the next block are a second access
+    crossings++;
+    unsigned long long low = readBlock(sim, address, first * 8);
+    return memory::extend(low | readBlock(sim, address + first, size - first * 8) << (first * 8), size, isSigned);
+}
+
+void CACHE::write(simulator &sim, long long data, long long address, int size)
+{
+    writes++;
+    if (address & (size / 8 - 1))
+        misaligned++;
+    int first = blockSize - address % blockSize;
+    if (size / 8 <= first)
+        return writeBlock(sim, data, address, size);
+
+    crossings++;
+    writeBlock(sim, data, address, first * 8);
+    writeBlock(sim, (unsigned long long)data >> (first * 8), address + first, size - first * 8);
+}
+
+unsigned long long CACHE::readBlock(simulator &sim, long long address, int size)
 {
-    int blockIndex = address % blockSize;
-    int hashValue = (address >> blockOffset) % noOfLines;
-    int tag = address >> (int(log2(noOfLines)) + blockOffset);
+    int blockIndex = address & (blockSize - 1);
+    int set = setOf(address);
+    long long tag = address >> (setBits + blockOffset);
 
-    int toBeReplacedIndex = checkHitOrMiss(hashValue, tag);
-    if (toBeReplacedIndex == -1)
+    int index = checkHitOrMiss(set, tag);
+    if (index == -1)
     {
         misses++;
-        toBeReplacedIndex = findVictim(hashValue);
-        if (WP == WB && table[hashValue][toBeReplacedIndex].valid && table[hashValue][toBeReplacedIndex].dirty)
-        {
-            int dummy = ((table[hashValue][toBeReplacedIndex].tag << int(log2(noOfLines))) + hashValue) << blockOffset;
-            for (int i = 0; i < blockSize; i++)
-                sim.memory[dummy++] = table[hashValue][toBeReplacedIndex].block[i];
-        }
+        index = findVictim(set);
+        if (valid[index])
+            evictions++;
+        if (WP == WB)
+            writeBack(sim, index, set);
 
-        int dummy = (address >> blockOffset) << blockOffset;
-        for (int i = 0; i < blockSize; i++)
-            table[hashValue][toBeReplacedIndex].block[i] = sim.memory[dummy++];
+        sim.ram.read(address & -(long long)blockSize, blockOf(index), blockSize);
 
-        table[hashValue][toBeReplacedIndex].RPdata = timeCounter++;
-        table[hashValue][toBeReplacedIndex].valid = true;
-        table[hashValue][toBeReplacedIndex].dirty = false;
-        table[hashValue][toBeReplacedIndex].tag = tag;
+        RPdata[index] = timeCounter++;
+        valid[index] = true;
+        dirty[index] = false;
+        tags[index] = tag;
 
         if (!this->file.is_open())
-            this->file.open(sim.fileName.substr(0, sim.fileName.find('.')) + ".output", std::ios::app);
-        file << "R: Address: 0x" << std::hex << address << ", Set: 0x" << hashValue << ", Miss, Tag: 0x" << tag << (table[hashValue][toBeReplacedIndex].dirty ? ", Dirty" : ", Clean") << std::endl;
+            this->file.open(sim.outputName, std::ios::app);
+        file << "R: Address: 0x" << std::hex << address << ", Set: 0x" << set << ", Miss, Tag: 0x" << tag << (dirty[index] ? ", Dirty" : ", Clean") << '\n';
     }
     else
     {
         hits++;
         if (RP == LRU)
-            table[hashValue][toBeReplacedIndex].RPdata = timeCounter++;
+            RPdata[index] = timeCounter++;
         if (!this->file.is_open())
-            this->file.open(sim.fileName.substr(0, sim.fileName.find('.')) + ".output", std::ios::app);
-        file << "R: Address: 0x" << std::hex << address << ", Set: 0x" << hashValue << ", Hit, Tag: 0x" << tag << (table[hashValue][toBeReplacedIndex].dirty ? ", Dirty" : ", Clean") << std::endl;
+            this->file.open(sim.outputName, std::ios::app);
+        file << "R: Address: 0x" << std::hex << address << ", Set: 0x" << set << ", Hit, Tag: 0x" << tag << (dirty[index] ? ", Dirty" : ", Clean") << '\n';
     }
 
-    long long data = 0;
-    for (int i = 0; i < size; i += 8)
-        data = data | ((long long)(table[hashValue][toBeReplacedIndex].block[blockIndex++]) << i);
-
-    if (isSigned && (data >> (size - 1)) == 1)
-        data = data | (~0ULL << size);
-    return data;
+    return memory::loadLittle(blockOf(index) + blockIndex, size / 8);
 }
 
-void CACHE::write(simulator &sim, long long data, int address, int size)
+void CACHE::writeBlock(simulator &sim, unsigned long long data, long long address, int size)
 {
-    int blockIndex = address % blockSize;
-    int hashValue = (address >> blockOffset) % noOfLines;
-    int tag = address >> (int(log2(noOfLines)) + blockOffset);
+    int blockIndex = address & (blockSize - 1);
+    int set = setOf(address);
+    long long tag = address >> (setBits + blockOffset);
 
-    int toBeReplacedIndex = checkHitOrMiss(hashValue, tag);
-    if (toBeReplacedIndex == -1)
+    int index = checkHitOrMiss(set, tag);
+    if (index == -1)
     {
         misses++;
-        toBeReplacedIndex = findVictim(hashValue);
+        index = findVictim(set);
         if (WP == WB)
         {
-            if (table[hashValue][toBeReplacedIndex].valid && table[hashValue][toBeReplacedIndex].dirty)
-            {
-                int dummy = ((table[hashValue][toBeReplacedIndex].tag << int(log2(noOfLines))) + hashValue) << blockOffset;
-                for (int i = 0; i < blockSize; i++)
-                    sim.memory[dummy++] = table[hashValue][toBeReplacedIndex].block[i];
-            }
-            int dummy = (address >> blockOffset) << blockOffset;
-            for (int i = 0; i < blockSize; i++)
-                table[hashValue][toBeReplacedIndex].block[i] = sim.memory[dummy++];
-
-            for (int i = 0; i < size; i = i + 8)
-                table[hashValue][toBeReplacedIndex].block[blockIndex++] = (data >> i) & 0b11111111;
-
-            table[hashValue][toBeReplacedIndex].valid = table[hashValue][toBeReplacedIndex].dirty = true;
-            table[hashValue][toBeReplacedIndex].RPdata = timeCounter++;
-            table[hashValue][toBeReplacedIndex].tag = tag;
+            if (valid[index])
+                evictions++;
+            writeBack(sim, index, set);
+            sim.ram.read(address & -(long long)blockSize, blockOf(index), blockSize);
+            memory::storeLittle(blockOf(index) + blockIndex, data, size / 8);
+
+            valid[index] = dirty[index] = true;
+            RPdata[index] = timeCounter++;
+            tags[index] = tag;
         }
         else
-        {
-            int dummy = address;
-            for (int i = 0; i < size; i = i + 8)
-                sim.memory[dummy++] = (data >> i) & 0b11111111;
-        }
+            writeThrough(sim, data, address, size);
 
         if (!this->file.is_open())
-            this->file.open(sim.fileName.substr(0, sim.fileName.find('.')) + ".output", std::ios::app);
-        file << "W: Address: 0x" << std::hex << address << ", Set: 0x" << hashValue << ", Miss, Tag: 0x" << tag << (table[hashValue][toBeReplacedIndex].dirty ? ", Dirty" : ", Clean") << std::endl;
+            this->file.open(sim.outputName, std::ios::app);
+        file << "W: Address: 0x" << std::hex << address << ", Set: 0x" << set << ", Miss, Tag: 0x" << tag << (dirty[index] ? ", Dirty" : ", Clean") << '\n';
     }
     else
     {
         hits++;
-        int dummy = address;
-        for (int i = 0; i < size; i = i + 8)
-        {
-            table[hashValue][toBeReplacedIndex].block[blockIndex++] = (data >> i) & 0b11111111;
-            if (WP == WT)
-                sim.memory[dummy++] = (data >> i) & 0b11111111;
-        }
+        memory::storeLittle(blockOf(index) + blockIndex, data, size / 8);
+        if (WP == WT)
+            writeThrough(sim, data, address, size);
         if (WP == WB)
-            table[hashValue][toBeReplacedIndex].dirty = true;
+            dirty[index] = true;
         if (RP == LRU)
-            table[hashValue][toBeReplacedIndex].RPdata = timeCounter++;
+            RPdata[index] = timeCounter++;
 
         if (!this->file.is_open())
-            this->file.open(sim.fileName.substr(0, sim.fileName.find('.')) + ".output", std::ios::app);
-        file << "W: Address: 0x" << std::hex << address << ", Set: 0x" << hashValue << ", Hit, Tag: 0x" << tag << (table[hashValue][toBeReplacedIndex].dirty ? ", Dirty" : ", Clean") << std::endl;
+            this->file.open(sim.outputName, std::ios::app);
+        file << "W: Address: 0x" << std::hex << address << ", Set: 0x" << set << ", Hit, Tag: 0x" << tag << (dirty[index] ? ", Dirty" : ", Clean") << '\n';
     }
 }
 
-void CACHE::printStatus()
+void CACHE::writeThrough(simulator &sim, unsigned long long data, long long address, int size)
+{
+    u_int8_t bytes[8];
+    memory::storeLittle(bytes, data, size / 8);
+    sim.ram.write(address, bytes, size / 8);
+}
+
+void CACHE::printStatus(std::ostream &out)
 {
-    std::cout << "Cache Size: " << cacheSize << std::endl
+    out << "Cache Size: " << cacheSize << std::endl
               << "Block Size: " << blockSize << std::endl
               << "Associativity: " << associativity << std::endl
               << "Replacement Policy: " << (RP == LRU ? "LRU" : (RP == FIFO ? "FIFO" : "RANDOM")) << std::endl
@@ -190,32 +247,44 @@ void CACHE::printStatus()
 
 void CACHE::invalidate(simulator &sim)
 {
-    for (int i = 0; i < noOfLines; i++)
-    {
-        for (int j = 0; j < associativity; j++)
+    for (int set = 0; set < noOfLines; set++)
+        for (int index = set * associativity; index < (set + 1) * associativity; index++)
         {
-            if (table[i][j].valid && table[i][j].dirty)
-            {
-                int dummy = ((table[i][j].tag << int(log2(noOfLines))) + i) << blockOffset;
-                for (int k = 0; k < blockSize; k++)
-                    sim.memory[dummy++] = table[i][j].block[k];
-            }
-            table[i][j].valid = false;
+            writeBack(sim, index, set);
+            valid[index] = false;
         }
-    }
 }
 
-void CACHE::printStats()
+void CACHE::printStats(std::ostream &out)
+{
+    out << "D-cache statistics: Accesses=" << hits + misses << ", Hit=" << hits << ", Miss=" << misses << ", Hit Rate=" << std::setprecision(2) << (double)hits / (hits + misses) << std::endl;
+    if (misaligned || crossings)
+        out << std::dec << "D-cache misaligned accesses=" << misaligned << ", Block-crossing accesses=" << crossings << std::endl;
+}
+
+void CACHE::statistics(simulator::cacheStatistics &stats)
 {
-    std::cout << "D-cache statistics: Accesses=" << hits + misses << ", Hit=" << hits << ", Miss=" << misses << ", Hit Rate=" << std::setprecision(2) << (double)hits / (hits + misses) << std::endl;
+    stats.accesses = hits + misses;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.reads = reads;
+    stats.writes = writes;
+    stats.evictions = evictions;
+    stats.writebacks = writebacks;
 }
 
 void CACHE::printCache(std::string fileName)
 {
     std::ofstream output(fileName);
-    for (int i = 0; i < noOfLines; i++)
-        for (int j = 0; j < associativity; j++)
-            if (table[i][j].valid)
-                output << "Set: 0x" << std::hex << i << ", Tag: 0x" << table[i][j].tag << ", " << (table[i][j].dirty ? "Dirty" : "Clean") << std::endl;
+    for (int set = 0; set < noOfLines; set++)
+        for (int index = set * associativity; index < (set + 1) * associativity; index++)
+            if (valid[index])
+                output << "Set: 0x" << std::hex << set << ", Tag: 0x" << tags[index] << ", " << (dirty[index] ? "Dirty" : "Clean") << std::endl;
     output.close();
+}
+
+void CACHE::flushLog()
+{
+    if (file.is_open())
+        file.flush();
 }
\ No newline at end of file
@@ -2,25 +2,14 @@
 #define CACHE_GUARD
 
 #include <vector>
+#include <climits>
 #include <cmath>
+#include <random>
 #include "simulator.hh"
 
 class CACHE
 {
 private:
-    struct line
-    {
-        bool valid;
-        bool dirty;
-        int RPdata;
-        int tag;
-        std::vector<u_int8_t> block;
-        line()
-        {
-            dirty = valid = false;
-        }
-    };
-
     enum replacementPolicy
     {
         FIFO,
@@ -37,27 +26,89 @@ private:
 
     replacementPolicy RP;
     writePolicy WP;
-    int timeCounter;
-    int misses;
-    int hits;
+    long long timeCounter;
+    // Each cache has its own generator so simulators can run side by side
+    std::minstd_rand random;
+    long long misses;
+    long long hits;
+    // Loads and stores asked of the cache, before any is split in two
+    long long reads;
+    long long writes;
+    // Valid lines replaced on a miss, and dirty lines copied back to memory
+    long long evictions;
+    long long writebacks;
+    // Accesses that are not aligned to their size, and those of them that
+    // run into the next block and are split in two
+    long long misaligned;
+    long long crossings;
 
     int cacheSize;
     int noOfLines;
     int associativity;
     int blockSize;
     int blockOffset;
-    std::vector<std::vector<line>> table;
-    int findVictim(int hashValue);
-    int checkHitOrMiss(int hashValue, int tag);
+    // The set of an address is its block number masked by setMask, or
+    // modulo noOfLines when that is not a power of two, and its tag is what
+    // is above the setBits bits of the set
+    int setBits;
+    long long setMask;
+    bool setsArePowerOfTwo;
+    // Line way of set is at set * associativity + way in every array, and
+    // its block at that index times blockSize in blocks, so a set is one
+    // run of tags and a lookup stays within a few cache lines of the host
+    std::vector<long long> tags;
+    // Time of the fill for FIFO, of the last use for LRU
+    std::vector<long long> RPdata;
+    std::vector<u_int8_t> valid;
+    std::vector<u_int8_t> dirty;
+    std::vector<u_int8_t> blocks;
+
+    int setOf(long long address)
+    {
+        long long block = address >> blockOffset;
+        return setsArePowerOfTwo ? block & setMask : block % noOfLines;
+    }
+
+    u_int8_t *blockOf(int index)
+    {
+        return blocks.data() + (size_t)index * blockSize;
+    }
+
+    // The address of the block in line index of set. Below the tag are
+    // setBits bits of the block number, fewer than noOfLines values, so
+    // without a mask they are the one that leaves the block in set.
+    long long blockAddress(int index, int set)
+    {
+        long long block = tags[index] << setBits;
+        if (setsArePowerOfTwo)
+            block += set;
+        else
+            block += ((set - block) % noOfLines + noOfLines) % noOfLines;
+        return block << blockOffset;
+    }
+
+    // Both return a line index, not a way
+    int findVictim(int set);
+    int checkHitOrMiss(int set, long long tag);
+    // Writes the line back to memory if it is dirty, counting it
+    void writeBack(simulator &sim, int index, int set);
+    unsigned long long readBlock(simulator &sim, long long address, int size);
+    void writeBlock(simulator &sim, unsigned long long data, long long address, int size);
+    void writeThrough(simulator &sim, unsigned long long data, long long address, int size);
 
 public:
     CACHE(int cacheSize, int blockSize, int associativity, std::string replacementPolicy, std::string writePolicy);
-    long long read(simulator &sim, int address, int size, bool isSigned);
-    void write(simulator &sim, long long data, int address, int size);
-    void printStatus();
+    CACHE(const CACHE &other);
+    void restore(const CACHE &other);
+    long long read(simulator &sim, long long address, int size, bool isSigned);
+    void write(simulator &sim, long long data, long long address, int size);
+    void printStatus(std::ostream &out);
     void invalidate(simulator& sim);
-    void printStats();
+    void printStats(std::ostream &out);
+    void statistics(simulator::cacheStatistics &stats);
     void printCache(std::string fileName);
+    // The access log is written in large pieces, this pushes out the rest
+    void flushLog();
 };
 
 #endif
\ No newline at end of file
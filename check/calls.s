@@ -0,0 +1,21 @@
+; jal x0 and jalr x0 in an assembly source keep the old rules: the jump to
+; skip is a call and the return from g pops a frame. Frames give the line
+; of the call, the innermost one the line about to run.
+; expect-stack 7 main:8 skip:10 f:15 g:18
+; expect-stack 9 main:8 skip:10 f:15
+      lui sp, 0x40
+main: addi a0, x0, 3
+      jal x0, skip
+      addi a0, x0, 9
+skip: jal ra, f
+      addi a1, a1, 1
+      beq x0, x0, end
+f:    addi sp, sp, -8
+      sd ra, 0(sp)
+      jal ra, g
+      ld ra, 0(sp)
+      addi sp, sp, 8
+      jalr x0, 0(ra)
+g:    addi a2, a2, 1
+      jalr x0, 0(ra)
+end:  add x0, x0, x0
@@ -0,0 +1,336 @@
+// Regression check of the execution modes against the decoded interpreter.
+//     check <source.s>...
+// Every source runs in each mode in steps of a few sizes, and the registers,
+// PC, retired count and call stack must match the decoded run after every
+// step, and the memory as well at the end. The sources also run with a
+// write-back and a write-through cache, which must not change what they
+// compute, the call graph must come out the same in every mode, and a
+// generated source is edited and reloaded in every mode.
+// A source can state what it must end with in comment lines
+//     ; expect x5 1
+//     ; expect-stack 7 main:3 f:10
+// the second giving the call stack after that many instructions.
+// Prints every difference and exits with 1 if there was any.
+#include "simulator.hh"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+    const char *modes[] = {"decoded", "binary", "block", "jit"};
+    // Step sizes, and how many steps are compared before the rest runs at once
+    const long long stepSizes[] = {1, 7, 100, 10007};
+    const int comparedSteps = 64;
+    // Runs with the cache simulator log every access, so they stop here
+    const long long cacheLimit = 200000;
+    const char *cacheConfigs[] = {"1024 16 2 LRU WB", "1024 16 2 LRU WT"};
+    // The default address space, compared at the end of every run
+    const long long memoryChecked = 0x50001;
+
+    int checks = 0, failures = 0;
+
+    std::unique_ptr<simulator> newSimulator(simulator::executionMode mode, std::string cacheConfig)
+    {
+        std::unique_ptr<simulator> sim(new simulator);
+        sim->discardOutput();
+        sim->setOutputName("/dev/null");
+        sim->setExecutionMode(mode);
+        sim->setJitThreshold(1);
+        if (!cacheConfig.empty())
+        {
+            sim->enableCache(cacheConfig);
+            sim->setInstructionLimit(cacheLimit);
+        }
+        return sim;
+    }
+
+    std::string stackOf(simulator &sim)
+    {
+        std::string frames;
+        for (auto &frame : sim.getStack())
+            frames += (frames.empty() ? "" : " ") + frame.first + ":" + std::to_string(frame.second);
+        return frames;
+    }
+
+    // What a run has computed so far, one item per line
+    std::string stateOf(simulator &sim, bool withMemory)
+    {
+        std::ostringstream state;
+        state << "pc " << sim.getPC() << "\nretired " << sim.getRetired() << "\nfinished " << sim.isFinished() << "\n";
+        std::array<long long, 32> registers = sim.getRegisters();
+        for (int i = 0; i < 32; i++)
+            state << "x" << i << " " << registers[i] << "\n";
+        state << "stack " << stackOf(sim) << "\n";
+        if (withMemory)
+        {
+            u_int64_t hash = 0xcbf29ce484222325ULL;
+            for (long long address = 0; address < memoryChecked; address++)
+                hash = (hash ^ sim.getMemory(address)) * 0x100000001b3ULL;
+            state << "memory " << std::hex << hash << std::dec << "\n";
+        }
+        return state.str();
+    }
+
+    void fail(std::string what, std::string detail)
+    {
+        failures++;
+        std::cout << "FAIL " << what << ": " << detail << std::endl;
+    }
+
+    // Counts a check, and reports the first line where the states differ
+    bool compare(std::string what, std::string expected, std::string actual)
+    {
+        checks++;
+        if (expected == actual)
+            return true;
+        std::istringstream e(expected), a(actual);
+        std::string expectedLine, actualLine;
+        while (std::getline(e, expectedLine) && std::getline(a, actualLine) && expectedLine == actualLine)
+            ;
+        fail(what, "expected " + expectedLine + ", got " + actualLine);
+        return false;
+    }
+
+    bool loaded(std::string what, simulator &sim)
+    {
+        if (sim.getErrors().empty())
+            return true;
+        checks++;
+        fail(what, sim.getErrors().front());
+        return false;
+    }
+
+    // Runs source in every mode in steps of step next to a decoded run
+    void checkSteps(std::string name, std::string source, long long step)
+    {
+        std::vector<std::unique_ptr<simulator>> sims;
+        for (int m = 0; m < 4; m++)
+        {
+            sims.push_back(newSimulator((simulator::executionMode)m, ""));
+            sims[m]->load(source);
+            if (!loaded(name + " " + modes[m], *sims[m]))
+                return;
+        }
+        bool same[4] = {true, true, true, true};
+        for (int i = 0; i < comparedSteps && !sims[0]->isFinished(); i++)
+        {
+            for (auto &sim : sims)
+                sim->run(false, true, step);
+            std::string expected = stateOf(*sims[0], false);
+            for (int m = 1; m < 4; m++)
+                if (same[m])
+                    same[m] = compare(name + " " + modes[m] + " run " + std::to_string(step) + " step " + std::to_string(i + 1),
+                                      expected, stateOf(*sims[m], false));
+        }
+        for (auto &sim : sims)
+            sim->run(false, true, -1);
+        std::string expected = stateOf(*sims[0], true);
+        for (int m = 1; m < 4; m++)
+            if (same[m])
+                compare(name + " " + modes[m] + " run " + std::to_string(step) + " end", expected, stateOf(*sims[m], true));
+    }
+
+    // A cache must not change what the program computes up to the limit
+    void checkCaches(std::string name, std::string source, std::string directory)
+    {
+        std::unique_ptr<simulator> reference = newSimulator(simulator::DECODED, "");
+        reference->setInstructionLimit(cacheLimit);
+        reference->load(source);
+        if (!loaded(name, *reference))
+            return;
+        reference->run(false, true, -1);
+        for (const char *config : cacheConfigs)
+        {
+            // Memory lags behind a write-back cache by its dirty lines
+            bool writeThrough = std::string(config).find("WT") != std::string::npos;
+            std::string expected = stateOf(*reference, writeThrough);
+            std::string configName = directory + "/cache.cfg";
+            std::ofstream(configName) << config << std::endl;
+            for (int m = 0; m < 4; m++)
+            {
+                std::unique_ptr<simulator> sim = newSimulator((simulator::executionMode)m, configName);
+                sim->load(source);
+                sim->run(false, true, -1);
+                compare(name + " " + modes[m] + " cache " + config, expected, stateOf(*sim, writeThrough));
+            }
+            unlink(configName.c_str());
+        }
+    }
+
+    // The call graph, written in collapsed form, must not depend on the mode
+    void checkCallGraph(std::string name, std::string source, std::string directory)
+    {
+        std::string folded = directory + "/callgraph.folded", expected;
+        for (int m = 0; m < 4; m++)
+        {
+            std::unique_ptr<simulator> sim = newSimulator((simulator::executionMode)m, "");
+            sim->load(source);
+            if (!loaded(name + " " + modes[m], *sim))
+                return;
+            sim->setCallGraph(true);
+            sim->run(false, true, -1);
+            sim->printCallGraph(folded);
+            std::ostringstream stacks;
+            stacks << std::ifstream(folded).rdbuf();
+            if (m == 0)
+                expected = stacks.str();
+            else
+                compare(name + " " + modes[m] + " call graph", expected, stacks.str());
+        }
+        unlink(folded.c_str());
+    }
+
+    // The expect lines of source, checked on a decoded run
+    void checkExpectations(std::string name, std::string source)
+    {
+        std::ifstream input(source);
+        std::string line;
+        while (std::getline(input, line))
+        {
+            std::istringstream words(line);
+            std::string semicolon, directive;
+            if (!(words >> semicolon >> directive) || semicolon != ";")
+                continue;
+            std::unique_ptr<simulator> sim = newSimulator(simulator::DECODED, "");
+            sim->load(source);
+            if (!loaded(name, *sim))
+                return;
+            if (directive == "expect")
+            {
+                std::string reg, value;
+                words >> reg >> value;
+                sim->run(false, true, -1);
+                int index = atoi(reg.c_str() + 1);
+                compare(name + " " + line, reg + " " + std::to_string(strtoll(value.c_str(), nullptr, 0)),
+                        reg + " " + std::to_string(sim->getRegisters()[index & 31]));
+            }
+            else if (directive == "expect-stack")
+            {
+                long long count;
+                std::string frames, frame;
+                words >> count;
+                while (words >> frame)
+                    frames += (frames.empty() ? "" : " ") + frame;
+                sim->run(false, true, count);
+                compare(name + " " + line, "stack " + frames, "stack " + stackOf(*sim));
+            }
+        }
+    }
+
+    // A source with data, a loop and a call, and edits to it that are
+    // applied one after the other: an immediate, a line inserted before
+    // labels, and a data value, which needs a full load
+    const char *reloadSource =
+        ".data\n"
+        ".dword 5\n"
+        ".text\n"
+        "main: lui x5, 0x10\n"
+        "      ld x6, 0(x5)\n"
+        "      addi x7, x0, 10\n"
+        "loop: addi x7, x7, -1\n"
+        "      add x8, x8, x6\n"
+        "      bne x7, x0, loop\n"
+        "      jal ra, f\n"
+        "      beq x0, x0, end\n"
+        "f:    addi x9, x8, 1\n"
+        "      jalr x0, 0(ra)\n"
+        "end:  add x0, x0, x0\n";
+    const std::pair<const char *, const char *> reloadEdits[] = {
+        {"addi x7, x0, 10", "addi x7, x0, 12"},
+        {"      jal ra, f\n", "      addi x10, x8, 3\n      jal ra, f\n"},
+        {".dword 5", ".dword 7"},
+    };
+
+    // Loads the source, runs part of it, edits and reloads it, and runs the
+    // rest, which must end as a fresh load of the edited source does
+    void checkReload(std::string directory)
+    {
+        std::string source = directory + "/reload.s", fresh = directory + "/fresh.s";
+        for (int m = 0; m < 4; m++)
+        {
+            std::string text = reloadSource;
+            std::ofstream(source) << text;
+            std::unique_ptr<simulator> sim = newSimulator((simulator::executionMode)m, "");
+            sim->load(source);
+            if (!loaded(std::string("reload ") + modes[m], *sim))
+                continue;
+            for (auto &edit : reloadEdits)
+            {
+                sim->run(false, true, 5);
+                text.replace(text.find(edit.first), std::string(edit.first).size(), edit.second);
+                std::ofstream(source) << text;
+                std::ofstream(fresh) << text;
+                sim->reload();
+                std::string what = std::string("reload ") + modes[m] + " " + edit.second;
+                if (!loaded(what, *sim))
+                    break;
+                sim->run(false, true, -1);
+                std::unique_ptr<simulator> reference = newSimulator(simulator::DECODED, "");
+                reference->load(fresh);
+                reference->run(false, true, -1);
+                compare(what.substr(0, what.find('\n')), stateOf(*reference, true), stateOf(*sim, true));
+                // Starts the program over for the next edit
+                sim->reload();
+            }
+        }
+        for (std::string name : {source, fresh})
+            unlink(name.c_str());
+    }
+
+    std::string objectName(std::string source)
+    {
+        return source.substr(0, source.rfind('.')) + ".obj";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: check <source.s>..." << std::endl;
+        return 1;
+    }
+
+    // Sources are copied to a directory of their own, as loading writes an
+    // object file next to the source
+    char directory[] = "/tmp/riscv_check.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        std::cerr << "Cannot create a directory for the sources" << std::endl;
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string fileName = argv[i], name = fileName.substr(fileName.rfind('/') + 1);
+        std::string source = std::string(directory) + "/" + name;
+        std::ifstream input(fileName);
+        if (!input)
+        {
+            checks++;
+            fail(name, "cannot read " + fileName);
+            continue;
+        }
+        std::ofstream(source) << input.rdbuf();
+        for (long long step : stepSizes)
+            checkSteps(name, source, step);
+        checkCaches(name, source, directory);
+        checkCallGraph(name, source, directory);
+        checkExpectations(name, source);
+        unlink(source.c_str());
+        unlink(objectName(source).c_str());
+    }
+    checkReload(directory);
+    for (std::string name : {"reload", "fresh"})
+        unlink(objectName(std::string(directory) + "/" + name + ".s").c_str());
+    rmdir(directory);
+
+    std::cout << checks - failures << " of " << checks << " checks passed" << std::endl;
+    return failures ? 1 : 0;
+}
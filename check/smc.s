@@ -0,0 +1,9 @@
+; The first pass stores a nop over the increment, so it runs once
+; expect x5 1
+; expect x6 0
+      addi x8, x0, 0x13
+      addi x6, x0, 40
+loop: addi x5, x5, 1
+      sw x8, 8(x0)
+      addi x6, x6, -1
+      bne x6, x0, loop
@@ -0,0 +1,121 @@
+#include "decoder.hh"
+
+namespace
+{
+    const decoder::operation branches[8] = {decoder::BEQ, decoder::BNE, decoder::INVALID, decoder::INVALID, decoder::BLT, decoder::BGE, decoder::BLTU, decoder::BGEU};
+    const decoder::operation loads[8] = {decoder::LB, decoder::LH, decoder::LW, decoder::LD, decoder::LBU, decoder::LHU, decoder::LWU, decoder::INVALID};
+    const decoder::operation stores[8] = {decoder::SB, decoder::SH, decoder::SW, decoder::SD, decoder::INVALID, decoder::INVALID, decoder::INVALID, decoder::INVALID};
+    const decoder::operation immediateArithmetic[8] = {decoder::ADDI, decoder::SLLI, decoder::SLTI, decoder::SLTIU, decoder::XORI, decoder::SRLI, decoder::ORI, decoder::ANDI};
+    const decoder::operation registerArithmetic[8] = {decoder::ADD, decoder::SLL, decoder::SLT, decoder::SLTU, decoder::XOR, decoder::SRL, decoder::OR, decoder::AND};
+    // Indexed by func3, plus 8 when func7 is 0x20
+    const decoder::operation wordArithmetic[16] = {decoder::ADDW, decoder::SLLW, decoder::INVALID, decoder::INVALID, decoder::INVALID, decoder::SRLW, decoder::INVALID, decoder::INVALID,
+                                                   decoder::SUBW, decoder::INVALID, decoder::INVALID, decoder::INVALID, decoder::INVALID, decoder::SRAW, decoder::INVALID, decoder::INVALID};
+}
+
+decoder::instruction decoder::decode(u_int32_t word, long long PC)
+{
+    instruction ins{};
+    int func3 = (word >> 12) & 0b111;
+    int func7 = word >> 25;
+    ins.rd = (word >> 7) & 0b11111;
+    ins.rs1 = (word >> 15) & 0b11111;
+    ins.rs2 = (word >> 20) & 0b11111;
+
+    switch (word & 0b1111111)
+    {
+    // LUI and AUIPC carry the already shifted upper immediate
+    case 0b0110111:
+        ins.op = LUI;
+        ins.imm = (int32_t)(word & 0xfffff000);
+        break;
+    case 0b0010111:
+        ins.op = AUIPC;
+        ins.imm = (int32_t)(word & 0xfffff000);
+        break;
+
+    case 0b1101111:
+        ins.op = JAL;
+        ins.imm = (int32_t)((((int32_t)word >> 31) << 20) | (word & 0xff000) | (((word >> 20) & 0b1) << 11) | (((word >> 21) & 0b1111111111) << 1));
+        ins.target = PC + ins.imm;
+        break;
+
+    case 0b1100111:
+        if (func3 == 0x0)
+            ins.op = JALR;
+        ins.imm = (int32_t)word >> 20;
+        break;
+
+    case 0b1100011:
+        ins.op = branches[func3];
+        ins.imm = (int32_t)((((int32_t)word >> 31) << 12) | (((word >> 7) & 0b1) << 11) | (((word >> 25) & 0b111111) << 5) | (((word >> 8) & 0b1111) << 1));
+        ins.target = PC + ins.imm;
+        break;
+
+    case 0b0000011:
+        ins.op = loads[func3];
+        ins.imm = (int32_t)word >> 20;
+        break;
+
+    case 0b0100011:
+        ins.op = stores[func3];
+        ins.imm = (int32_t)((((int32_t)word >> 25) << 5) | ((word >> 7) & 0b11111));
+        break;
+
+    case 0b0010011:
+        ins.op = immediateArithmetic[func3];
+        ins.imm = (int32_t)word >> 20;
+        // slli, srli and srai split the immediate into func6 and a 6 bit shamt
+        if (func3 == 0x1 || func3 == 0x5)
+        {
+            ins.imm = (word >> 20) & 0b111111;
+            if (func7 >> 1 == 0x10 && func3 == 0x5)
+                ins.op = SRAI;
+            else if (func7 >> 1 != 0x0)
+                ins.op = INVALID;
+        }
+        break;
+
+    case 0b0110011:
+        if (func7 == 0x0)
+            ins.op = registerArithmetic[func3];
+        else if (func7 == 0x20 && func3 == 0x0)
+            ins.op = SUB;
+        else if (func7 == 0x20 && func3 == 0x5)
+            ins.op = SRA;
+        break;
+
+    // The W forms work on the low 32 bits and sign extend the result
+    case 0b0011011:
+        ins.imm = (int32_t)word >> 20;
+        if (func3 == 0x0)
+            ins.op = ADDIW;
+        else if (func3 == 0x1 || func3 == 0x5)
+        {
+            ins.imm = (word >> 20) & 0b11111;
+            if (func7 == 0x0)
+                ins.op = func3 == 0x1 ? SLLIW : SRLIW;
+            else if (func7 == 0x20 && func3 == 0x5)
+                ins.op = SRAIW;
+        }
+        break;
+
+    case 0b0111011:
+        ins.op = wordArithmetic[func3 + (func7 == 0x20 ? 8 : 0)];
+        if (func7 != 0x0 && func7 != 0x20)
+            ins.op = INVALID;
+        break;
+
+    // fence and fence.i order nothing in a simulator that runs one hart and
+    // already sees stores into the text section
+    case 0b0001111:
+        if (func3 == 0x0 || func3 == 0x1)
+            ins.op = FENCE;
+        break;
+
+    case 0b1110011:
+        if (word == 0x00000073)
+            ins.op = ECALL;
+        break;
+    }
+    return ins;
+}
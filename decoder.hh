@@ -0,0 +1,86 @@
+#ifndef DECODER_GUARD
+#define DECODER_GUARD
+
+#include <sys/types.h>
+
+namespace decoder
+{
+    enum operation : u_int8_t
+    {
+        INVALID,
+        LUI,
+        AUIPC,
+        JAL,
+        JALR,
+        BEQ,
+        BNE,
+        BLT,
+        BGE,
+        BLTU,
+        BGEU,
+        LB,
+        LH,
+        LW,
+        LD,
+        LBU,
+        LHU,
+        LWU,
+        SB,
+        SH,
+        SW,
+        SD,
+        ADDI,
+        SLTI,
+        SLTIU,
+        XORI,
+        ORI,
+        ANDI,
+        SLLI,
+        SRLI,
+        SRAI,
+        ADD,
+        SUB,
+        SLL,
+        SLT,
+        SLTU,
+        XOR,
+        SRL,
+        SRA,
+        OR,
+        AND,
+        ADDIW,
+        SLLIW,
+        SRLIW,
+        SRAIW,
+        ADDW,
+        SUBW,
+        SLLW,
+        SRLW,
+        SRAW,
+        FENCE,
+        ECALL
+    };
+
+    // Fixed size record of an instruction with every operand already resolved,
+    // so executing it needs no string handling or table lookups.
+    struct instruction
+    {
+        operation op;
+        u_int8_t rd;
+        u_int8_t rs1;
+        u_int8_t rs2;
+        long long imm;
+        long long target;
+    };
+
+    instruction decode(u_int32_t word, long long PC);
+
+    // Branches, jumps and system calls end a basic block, and so does anything
+    // that cannot be decoded
+    inline bool endsBlock(operation op)
+    {
+        return op == INVALID || op == ECALL || (op >= JAL && op <= BGEU);
+    }
+}
+
+#endif
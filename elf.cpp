@@ -0,0 +1,87 @@
+#include "elf.hh"
+#include <cstring>
+#include <elf.h>
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+namespace
+{
+    // A table of count entries of size bytes at offset, false if any of it is past the end
+    bool fits(std::string_view file, u_int64_t offset, u_int64_t count, u_int64_t size)
+    {
+        return offset <= file.size() && (size == 0 || count <= (file.size() - offset) / size);
+    }
+
+    template <typename T>
+    T at(std::string_view file, u_int64_t offset)
+    {
+        T value;
+        memcpy(&value, file.data() + offset, sizeof(T));
+        return value;
+    }
+}
+
+bool elf::isElf(std::string_view file)
+{
+    return file.size() >= SELFMAG && memcmp(file.data(), ELFMAG, SELFMAG) == 0;
+}
+
+std::string elf::read(std::string_view file, image &result)
+{
+    if (!isElf(file) || file.size() < sizeof(Elf64_Ehdr))
+        return "Not an ELF file";
+    Elf64_Ehdr header = at<Elf64_Ehdr>(file, 0);
+    if (header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_ident[EI_DATA] != ELFDATA2LSB || header.e_machine != EM_RISCV)
+        return "Not a little-endian RV64 ELF file";
+    if (header.e_type != ET_EXEC)
+        return "Only statically linked executables can be loaded";
+    if (header.e_phentsize != sizeof(Elf64_Phdr) || !fits(file, header.e_phoff, header.e_phnum, sizeof(Elf64_Phdr)))
+        return "Broken program header table";
+
+    result.entry = header.e_entry;
+    result.flags = header.e_flags;
+    result.segments.clear();
+    result.symbols.clear();
+    for (int i = 0; i < header.e_phnum; i++)
+    {
+        Elf64_Phdr program = at<Elf64_Phdr>(file, header.e_phoff + i * sizeof(Elf64_Phdr));
+        if (program.p_type != PT_LOAD || program.p_memsz == 0)
+            continue;
+        if (!fits(file, program.p_offset, program.p_filesz, 1) || program.p_filesz > program.p_memsz || program.p_vaddr >= (1ULL << 48) || program.p_memsz >= (1ULL << 48))
+            return "Broken loadable segment";
+        result.segments.push_back({(long long)program.p_vaddr, file.substr(program.p_offset, program.p_filesz), (long long)program.p_memsz, (program.p_flags & PF_X) != 0});
+    }
+    if (result.segments.empty())
+        return "No loadable segments";
+
+    // The symbol table is optional, a stripped file just has no labels
+    if (header.e_shentsize != sizeof(Elf64_Shdr) || !fits(file, header.e_shoff, header.e_shnum, sizeof(Elf64_Shdr)))
+        return "";
+    for (int i = 0; i < header.e_shnum; i++)
+    {
+        Elf64_Shdr section = at<Elf64_Shdr>(file, header.e_shoff + i * sizeof(Elf64_Shdr));
+        if (section.sh_type != SHT_SYMTAB || section.sh_link >= header.e_shnum)
+            continue;
+        Elf64_Shdr strings = at<Elf64_Shdr>(file, header.e_shoff + section.sh_link * sizeof(Elf64_Shdr));
+        u_int64_t count = section.sh_entsize == sizeof(Elf64_Sym) ? section.sh_size / sizeof(Elf64_Sym) : 0;
+        if (!fits(file, section.sh_offset, count, sizeof(Elf64_Sym)) || !fits(file, strings.sh_offset, strings.sh_size, 1))
+            return "Broken symbol table";
+        std::string_view names = file.substr(strings.sh_offset, strings.sh_size);
+        for (u_int64_t k = 1; k < count; k++)
+        {
+            Elf64_Sym sym = at<Elf64_Sym>(file, section.sh_offset + k * sizeof(Elf64_Sym));
+            int type = ELF64_ST_TYPE(sym.st_info);
+            if (sym.st_shndx == SHN_UNDEF || sym.st_name >= names.size() || (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE))
+                continue;
+            std::string_view name = names.substr(sym.st_name);
+            name = name.substr(0, name.find('\0'));
+            // Mapping symbols such as $x and local compiler labels are not worth a name
+            if (name.empty() || name[0] == '$' || name.substr(0, 2) == ".L")
+                continue;
+            result.symbols.push_back({name, (long long)sym.st_value, type == STT_FUNC});
+        }
+    }
+    return "";
+}
@@ -0,0 +1,45 @@
+#ifndef ELF_GUARD
+#define ELF_GUARD
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Reader for statically linked RV64 executables. Everything it returns is a
+// view into the file, which the caller keeps mapped.
+namespace elf
+{
+    struct segment
+    {
+        long long address;
+        // The bytes in the file, the rest of size up to memorySize is zero
+        std::string_view data;
+        long long memorySize;
+        bool executable;
+    };
+
+    struct symbol
+    {
+        std::string_view name;
+        long long address;
+        bool function;
+    };
+
+    // e_flags bit of code that uses the C extension
+    const unsigned compressed = 0x1;
+
+    struct image
+    {
+        long long entry;
+        unsigned flags;
+        std::vector<segment> segments;
+        std::vector<symbol> symbols;
+    };
+
+    bool isElf(std::string_view file);
+
+    // Fills result from the file, or returns what is wrong with it
+    std::string read(std::string_view file, image &result);
+}
+
+#endif
@@ -0,0 +1,384 @@
+#include "jit.hh"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+#include <cstring>
+#include <cstddef>
+#include <utility>
+
+namespace
+{
+    const int RAX = 0, RCX = 1;
+    const int BELOW = 0x2, ABOVE_EQUAL = 0x3, EQUAL = 0x4, NOT_EQUAL = 0x5, ABOVE = 0x7, LESS = 0xC, GREATER_EQUAL = 0xD;
+    const int READ_TABLE = offsetof(memory::recentPages, read), WRITE_TABLE = offsetof(memory::recentPages, write);
+    const int PAGE_DATA = offsetof(memory::recentRead, data);
+    // Entries are found by shifting the index left by 4
+    static_assert(sizeof(memory::recentRead) == 16 && sizeof(memory::recentWrite) == 16 && offsetof(memory::recentWrite, data) == PAGE_DATA, "recent page entries must be 16 bytes");
+    static_assert(memory::recentSize <= 128, "the index mask must fit in a signed byte");
+
+    // Host registers: rdi = registers, rsi = recent pages, rdx = PC out pointer,
+    // rax and rcx hold operands, r8 and r9 pick the next PC of a branch and
+    // r10 finds the entry of the page a load or store goes to, then points at
+    // the page.
+    struct emitter
+    {
+        std::vector<u_int8_t> bytes;
+        std::vector<std::pair<size_t, int>> exits;
+
+        void emit(std::initializer_list<int> values)
+        {
+            for (int value : values)
+                bytes.push_back(value);
+        }
+
+        void emit32(long long value)
+        {
+            for (int i = 0; i < 32; i += 8)
+                bytes.push_back((value >> i) & 0b11111111);
+        }
+
+        void emit64(long long value)
+        {
+            for (int i = 0; i < 64; i += 8)
+                bytes.push_back((value >> i) & 0b11111111);
+        }
+
+        // mov rax/rcx, [rdi + 8 * index]
+        void loadRegister(int host, int index)
+        {
+            emit({0x48, 0x8B, 0x87 | host << 3});
+            emit32(index * 8);
+        }
+
+        // mov [rdi + 8 * index], rax; x0 is never written
+        void storeRegister(int index)
+        {
+            if (index == 0)
+                return;
+            emit({0x48, 0x89, 0x87});
+            emit32(index * 8);
+        }
+
+        // jcc rel32 to the exit stub of instruction k, patched in finish()
+        void exitIf(int condition, int k)
+        {
+            emit({0x0F, 0x80 | condition});
+            exits.push_back({bytes.size(), k});
+            emit32(0);
+        }
+
+        // mov qword [rdx], PC; mov eax, count; ret
+        void leave(long long PC, int count, bool storePC)
+        {
+            if (storePC)
+            {
+                emit({0x48, 0xC7, 0x02});
+                emit32(PC);
+            }
+            emit({0xB8});
+            emit32(count);
+            emit({0xC3});
+        }
+
+        // rcx = page number of the address in rax, r10 = offset of its entry
+        // in the table; cmp rcx, [rsi + r10 + table]
+        void comparePage(int table)
+        {
+            // mov rcx, rax; shr rcx, pageBits; mov r10, rcx; and r10d, recentSize - 1; shl r10d, 4
+            emit({0x48, 0x89, 0xC1, 0x48, 0xC1, 0xE9, memory::pageBits, 0x49, 0x89, 0xCA});
+            emit({0x41, 0x83, 0xE2, memory::recentSize - 1, 0x41, 0xC1, 0xE2, 4});
+            emit({0x4A, 0x3B, 0x8C, 0x16});
+            emit32(table);
+        }
+
+        // mov r10, [rsi + r10 + table + PAGE_DATA]
+        void loadPage(int table)
+        {
+            emit({0x4E, 0x8B, 0x94, 0x16});
+            emit32(table + PAGE_DATA);
+        }
+
+        // Leaves rax as the offset into the page. Misaligned accesses exit so
+        // the interpreter counts them, which also keeps the rest inside the page.
+        void pageOffset(int size, int k)
+        {
+            if (size > 1)
+            {
+                // test al, size - 1
+                emit({0xA8, size - 1});
+                exitIf(NOT_EQUAL, k);
+            }
+            emit({0x25});
+            emit32(memory::pageSize - 1);
+        }
+
+        void finish(long long PC)
+        {
+            for (auto exit : exits)
+            {
+                long long offset = bytes.size() - (exit.first + 4);
+                for (int i = 0; i < 4; i++)
+                    bytes[exit.first + i] = (offset >> (8 * i)) & 0b11111111;
+                leave(PC + 4 * exit.second, exit.second, true);
+            }
+        }
+    };
+
+}
+
+jit::code::~code()
+{
+    if (mapping)
+        munmap(mapping, size);
+}
+
+void jit::code::install(const std::vector<u_int8_t> &bytes)
+{
+    size = bytes.size();
+    mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        mapping = nullptr;
+        return;
+    }
+    memcpy(mapping, bytes.data(), size);
+    if (mprotect(mapping, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(mapping, size);
+        mapping = nullptr;
+        return;
+    }
+    entry = (function)mapping;
+}
+
+bool jit::available()
+{
+    return true;
+}
+
+int jit::compile(const std::vector<decoder::instruction> &ops, long long PC, long long textEnd, bool memoryAccess, code &out)
+{
+    emitter e;
+    int count = 0;
+    bool branched = false, stop = false;
+    while (count < ops.size() && !branched)
+    {
+        const decoder::instruction &ins = ops[count];
+        long long address = PC + 4 * count;
+        int size = 0;
+        switch (ins.op)
+        {
+        // R Type Instructions
+        case decoder::ADD:
+        case decoder::SUB:
+        case decoder::XOR:
+        case decoder::OR:
+        case decoder::AND:
+        case decoder::SLL:
+        case decoder::SRL:
+        case decoder::SRA:
+        case decoder::SLT:
+        case decoder::SLTU:
+            e.loadRegister(RAX, ins.rs1);
+            e.loadRegister(RCX, ins.rs2);
+            if (ins.op == decoder::ADD)
+                e.emit({0x48, 0x01, 0xC8});
+            else if (ins.op == decoder::SUB)
+                e.emit({0x48, 0x29, 0xC8});
+            else if (ins.op == decoder::XOR)
+                e.emit({0x48, 0x31, 0xC8});
+            else if (ins.op == decoder::OR)
+                e.emit({0x48, 0x09, 0xC8});
+            else if (ins.op == decoder::AND)
+                e.emit({0x48, 0x21, 0xC8});
+            // x86 masks 64-bit shift counts to 6 bits just like RV64
+            else if (ins.op == decoder::SLL)
+                e.emit({0x48, 0xD3, 0xE0});
+            else if (ins.op == decoder::SRL)
+                e.emit({0x48, 0xD3, 0xE8});
+            else if (ins.op == decoder::SRA)
+                e.emit({0x48, 0xD3, 0xF8});
+            else
+                // cmp rax, rcx; setl/setb al; movzx rax, al
+                e.emit({0x48, 0x39, 0xC8, 0x0F, 0x90 | (ins.op == decoder::SLT ? LESS : BELOW), 0xC0, 0x48, 0x0F, 0xB6, 0xC0});
+            e.storeRegister(ins.rd);
+            break;
+
+        // I type Instructions
+        case decoder::ADDI:
+        case decoder::XORI:
+        case decoder::ORI:
+        case decoder::ANDI:
+        case decoder::SLTI:
+        case decoder::SLTIU:
+            e.loadRegister(RAX, ins.rs1);
+            if (ins.op == decoder::ADDI)
+                e.emit({0x48, 0x05});
+            else if (ins.op == decoder::XORI)
+                e.emit({0x48, 0x35});
+            else if (ins.op == decoder::ORI)
+                e.emit({0x48, 0x0D});
+            else if (ins.op == decoder::ANDI)
+                e.emit({0x48, 0x25});
+            else
+                e.emit({0x48, 0x3D});
+            e.emit32(ins.imm);
+            if (ins.op == decoder::SLTI || ins.op == decoder::SLTIU)
+                e.emit({0x0F, 0x90 | (ins.op == decoder::SLTI ? LESS : BELOW), 0xC0, 0x48, 0x0F, 0xB6, 0xC0});
+            e.storeRegister(ins.rd);
+            break;
+        case decoder::SLLI:
+        case decoder::SRLI:
+        case decoder::SRAI:
+            e.loadRegister(RAX, ins.rs1);
+            e.emit({0x48, 0xC1, ins.op == decoder::SLLI ? 0xE0 : (ins.op == decoder::SRLI ? 0xE8 : 0xF8), (int)ins.imm});
+            e.storeRegister(ins.rd);
+            break;
+
+        case decoder::LUI:
+            e.emit({0x48, 0xC7, 0xC0});
+            e.emit32(ins.imm);
+            e.storeRegister(ins.rd);
+            break;
+        case decoder::AUIPC:
+            e.emit({0x48, 0xB8});
+            e.emit64(address + ins.imm);
+            e.storeRegister(ins.rd);
+            break;
+
+        // Load Type Instructions: a page missing from the read table goes back
+        // to the interpreter, which brings it in or reports the error.
+        case decoder::LB:
+        case decoder::LBU:
+        case decoder::LH:
+        case decoder::LHU:
+        case decoder::LW:
+        case decoder::LWU:
+        case decoder::LD:
+            if (!memoryAccess)
+            {
+                stop = true;
+                break;
+            }
+            size = ins.op == decoder::LB || ins.op == decoder::LBU ? 1 : (ins.op == decoder::LH || ins.op == decoder::LHU ? 2 : (ins.op == decoder::LD ? 8 : 4));
+            e.loadRegister(RAX, ins.rs1);
+            e.emit({0x48, 0x05});
+            e.emit32(ins.imm);
+            e.comparePage(READ_TABLE);
+            e.exitIf(NOT_EQUAL, count);
+            e.loadPage(READ_TABLE);
+            e.pageOffset(size, count);
+            // movsx/movzx/mov rax, [r10 + rax]
+            if (ins.op == decoder::LB)
+                e.emit({0x49, 0x0F, 0xBE, 0x04, 0x02});
+            else if (ins.op == decoder::LBU)
+                e.emit({0x41, 0x0F, 0xB6, 0x04, 0x02});
+            else if (ins.op == decoder::LH)
+                e.emit({0x49, 0x0F, 0xBF, 0x04, 0x02});
+            else if (ins.op == decoder::LHU)
+                e.emit({0x41, 0x0F, 0xB7, 0x04, 0x02});
+            else if (ins.op == decoder::LW)
+                e.emit({0x49, 0x63, 0x04, 0x02});
+            else if (ins.op == decoder::LWU)
+                e.emit({0x41, 0x8B, 0x04, 0x02});
+            else
+                e.emit({0x49, 0x8B, 0x04, 0x02});
+            e.storeRegister(ins.rd);
+            break;
+
+        // S type Instructions: only the write table is used, so shared pages are
+        // copied by the interpreter first. Stores into the text section also go
+        // back to the interpreter so the translations get invalidated.
+        case decoder::SB:
+        case decoder::SH:
+        case decoder::SW:
+        case decoder::SD:
+            if (!memoryAccess)
+            {
+                stop = true;
+                break;
+            }
+            size = ins.op == decoder::SB ? 1 : (ins.op == decoder::SH ? 2 : (ins.op == decoder::SW ? 4 : 8));
+            e.loadRegister(RAX, ins.rs1);
+            e.emit({0x48, 0x05});
+            e.emit32(ins.imm);
+            e.emit({0x48, 0x3D});
+            e.emit32(textEnd);
+            e.exitIf(BELOW, count);
+            e.comparePage(WRITE_TABLE);
+            e.exitIf(NOT_EQUAL, count);
+            e.loadPage(WRITE_TABLE);
+            e.pageOffset(size, count);
+            e.loadRegister(RCX, ins.rs2);
+            // mov [r10 + rax], cl/cx/ecx/rcx
+            if (ins.op == decoder::SB)
+                e.emit({0x41, 0x88, 0x0C, 0x02});
+            else if (ins.op == decoder::SH)
+                e.emit({0x66, 0x41, 0x89, 0x0C, 0x02});
+            else if (ins.op == decoder::SW)
+                e.emit({0x41, 0x89, 0x0C, 0x02});
+            else
+                e.emit({0x49, 0x89, 0x0C, 0x02});
+            break;
+
+        // B Type Instructions: cmp rax, rcx; r8 = fall through; r9 = target;
+        // cmovcc r8, r9; mov [rdx], r8
+        case decoder::BEQ:
+        case decoder::BNE:
+        case decoder::BLT:
+        case decoder::BGE:
+        case decoder::BLTU:
+        case decoder::BGEU:
+        {
+            int condition = ins.op == decoder::BEQ ? EQUAL : (ins.op == decoder::BNE ? NOT_EQUAL : (ins.op == decoder::BLT ? LESS : (ins.op == decoder::BGE ? GREATER_EQUAL : (ins.op == decoder::BLTU ? BELOW : ABOVE_EQUAL))));
+            e.loadRegister(RAX, ins.rs1);
+            e.loadRegister(RCX, ins.rs2);
+            e.emit({0x48, 0x39, 0xC8, 0x49, 0xB8});
+            e.emit64(address + 4);
+            e.emit({0x49, 0xB9});
+            e.emit64(ins.target);
+            e.emit({0x4D, 0x0F, 0x40 | condition, 0xC1, 0x4C, 0x89, 0x02});
+            branched = true;
+            break;
+        }
+
+        // jal, jalr and undecodable words stay with the interpreter
+        default:
+            stop = true;
+        }
+        if (stop)
+            break;
+        count++;
+    }
+
+    if (count == 0)
+        return 0;
+
+    e.leave(PC + 4 * count, count, !branched);
+    e.finish(PC);
+    out.install(e.bytes);
+    return out.entry ? count : 0;
+}
+
+#else
+
+jit::code::~code()
+{
+}
+
+void jit::code::install(const std::vector<u_int8_t> &bytes)
+{
+}
+
+bool jit::available()
+{
+    return false;
+}
+
+int jit::compile(const std::vector<decoder::instruction> &ops, long long PC, long long textEnd, bool memoryAccess, code &out)
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef JIT_GUARD
+#define JIT_GUARD
+
+#include <vector>
+#include <cstddef>
+#include "decoder.hh"
+#include "memory.hh"
+
+namespace jit
+{
+    // Native code for a block returns how many instructions it executed and
+    // stores the PC to continue from, so it can hand back to the interpreter
+    // in the middle of a block. Loads and stores only reach the pages held
+    // in recent and leave the rest to the interpreter.
+    typedef int (*function)(long long *registers, memory::recentPages *recent, long long *PC);
+
+    // Owns the executable mapping of one compiled block
+    class code
+    {
+    private:
+        void *mapping;
+        size_t size;
+
+    public:
+        function entry;
+
+        code()
+        {
+            mapping = nullptr;
+            size = 0;
+            entry = nullptr;
+        }
+        code(const code &) = delete;
+        code &operator=(const code &) = delete;
+        ~code();
+
+        void install(const std::vector<u_int8_t> &bytes);
+    };
+
+    bool available();
+
+    // Compiles the longest prefix of ops that can run natively and returns its
+    // length. jal and jalr are left to the interpreter as they touch the call
+    // Stack; loads and stores are only compiled when memoryAccess is set.
+    int compile(const std::vector<decoder::instruction> &ops, long long PC, long long textEnd, bool memoryAccess, code &out);
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include "memory.hh"
+#include <algorithm>
+
+namespace
+{
+    const memory::page zeroPage{};
+}
+
+void memory::forgetRecent()
+{
+    for (recentRead &entry : recent.read)
+        entry = {noPage, nullptr};
+    forgetRecentWrites();
+}
+
+void memory::forgetRecentWrites()
+{
+    for (recentWrite &entry : recent.write)
+        entry = {noPage, nullptr};
+}
+
+void memory::clear()
+{
+    pages.clear();
+    copies = misaligned = pageCrossings = 0;
+    forgetRecent();
+}
+
+void memory::setSize(long long size)
+{
+    limit = size;
+    // A page that now straddles the limit must not be served by the fast path
+    forgetRecent();
+}
+
+const u_int8_t *memory::findReadable(long long number)
+{
+    auto found = pages.find(number);
+    const u_int8_t *data = found == pages.end() ? zeroPage.data() : found->second->data();
+    if ((number + 1) << pageBits <= limit)
+        recent.read[number & (recentSize - 1)] = {number, data};
+    return data;
+}
+
+u_int8_t *memory::findWritable(long long number)
+{
+    std::shared_ptr<page> &p = pages[number];
+    if (!p)
+        p = std::make_shared<page>();
+    else if (p.use_count() > 1)
+    {
+        p = std::make_shared<page>(*p);
+        copies++;
+    }
+
+    recentRead &read = recent.read[number & (recentSize - 1)];
+    if (read.number == number)
+        read.data = p->data();
+    if ((number + 1) << pageBits <= limit)
+        recent.write[number & (recentSize - 1)] = {number, p->data()};
+    return p->data();
+}
+
+unsigned long long memory::loadCrossing(long long address, int bytes)
+{
+    pageCrossings++;
+    unsigned long long value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= (unsigned long long)readByte(address + i) << (8 * i);
+    return value;
+}
+
+void memory::storeCrossing(long long address, unsigned long long value, int bytes)
+{
+    pageCrossings++;
+    for (int i = 0; i < bytes; i++)
+        writeByte(address + i, value >> (8 * i));
+}
+
+void memory::read(long long address, u_int8_t *data, long long size)
+{
+    while (size > 0)
+    {
+        long long chunk = std::min(size, pageSize - (address & (pageSize - 1)));
+        memcpy(data, readable(address), chunk);
+        address += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+void memory::write(long long address, const u_int8_t *data, long long size)
+{
+    while (size > 0)
+    {
+        long long chunk = std::min(size, pageSize - (address & (pageSize - 1)));
+        memcpy(writable(address), data, chunk);
+        address += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+memory::pageTable memory::snapshot()
+{
+    // Every page is shared from now on, so the next write to each one goes
+    // through findWritable and gets copied
+    forgetRecentWrites();
+    return pages;
+}
+
+std::vector<long long> memory::restore(const pageTable &saved)
+{
+    std::vector<long long> changed;
+    for (auto &p : pages)
+    {
+        auto found = saved.find(p.first);
+        if (found == saved.end() || found->second != p.second)
+            changed.push_back(p.first);
+    }
+    for (auto &p : saved)
+        if (pages.find(p.first) == pages.end())
+            changed.push_back(p.first);
+
+    pages = saved;
+    forgetRecent();
+    return changed;
+}
+
+void memory::printStats(std::ostream &out)
+{
+    out << std::dec << "Memory statistics: Address space=" << limit << " bytes, Pages touched=" << pages.size() << ", Resident=" << pages.size() * pageSize << " bytes, Copy-on-write copies=" << copies << ", Misaligned accesses=" << misaligned << ", Page-crossing accesses=" << pageCrossings << std::endl;
+}
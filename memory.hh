@@ -0,0 +1,213 @@
+#ifndef MEMORY_GUARD
+#define MEMORY_GUARD
+
+#include <array>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <ostream>
+#include <unordered_map>
+#include <sys/types.h>
+
+// Sparse guest memory. Pages are allocated on the first write and pages that
+// were never written read as zero. Snapshots share pages with the live table
+// and a shared page is copied on its next write.
+class memory
+{
+public:
+    static const int pageBits = 12;
+    static const long long pageSize = 1LL << pageBits;
+    typedef std::array<u_int8_t, pageSize> page;
+    typedef std::unordered_map<long long, std::shared_ptr<page>> pageTable;
+
+    // Recently used pages for reads and for writes, direct mapped by the low
+    // bits of the page number. Compiled blocks look pages up here as well and
+    // hand back to the interpreter when the entry holds another page.
+    static const int recentSize = 64;
+    static constexpr long long noPage = LLONG_MIN;
+    struct recentRead
+    {
+        long long number;
+        const u_int8_t *data;
+    };
+    struct recentWrite
+    {
+        long long number;
+        u_int8_t *data;
+    };
+    struct recentPages
+    {
+        recentRead read[recentSize];
+        recentWrite write[recentSize];
+    };
+
+private:
+    pageTable pages;
+    long long limit;
+    recentPages recent;
+    long long copies;
+    long long misaligned;
+    long long pageCrossings;
+
+    const u_int8_t *findReadable(long long number);
+
+    u_int8_t *findWritable(long long number);
+
+    void forgetRecent();
+
+    void forgetRecentWrites();
+
+    unsigned long long loadCrossing(long long address, int bytes);
+
+    void storeCrossing(long long address, unsigned long long value, int bytes);
+
+public:
+    memory()
+    {
+        limit = 0x50001;
+        clear();
+    }
+
+    void clear();
+
+    void setSize(long long size);
+
+    long long size()
+    {
+        return limit;
+    }
+
+    bool contains(long long address, int bytes)
+    {
+        return address >= 0 && address <= limit - bytes;
+    }
+
+    const u_int8_t *readable(long long address)
+    {
+        long long number = address >> pageBits;
+        const recentRead &entry = recent.read[number & (recentSize - 1)];
+        return (entry.number == number ? entry.data : findReadable(number)) + (address & (pageSize - 1));
+    }
+
+    u_int8_t *writable(long long address)
+    {
+        long long number = address >> pageBits;
+        const recentWrite &entry = recent.write[number & (recentSize - 1)];
+        return (entry.number == number ? entry.data : findWritable(number)) + (address & (pageSize - 1));
+    }
+
+    u_int8_t readByte(long long address)
+    {
+        return *readable(address);
+    }
+
+    void writeByte(long long address, u_int8_t value)
+    {
+        *writable(address) = value;
+    }
+
+    // Little-endian value of 1, 2, 4 or 8 bytes. A misaligned access is
+    // counted, and one that runs into the next page goes byte by byte.
+    unsigned long long load(long long address, int bytes)
+    {
+        if (address & (bytes - 1))
+        {
+            misaligned++;
+            if ((address & (pageSize - 1)) + bytes > pageSize)
+                return loadCrossing(address, bytes);
+        }
+        return loadLittle(readable(address), bytes);
+    }
+
+    void store(long long address, unsigned long long value, int bytes)
+    {
+        if (address & (bytes - 1))
+        {
+            misaligned++;
+            if ((address & (pageSize - 1)) + bytes > pageSize)
+                return storeCrossing(address, value, bytes);
+        }
+        storeLittle(writable(address), value, bytes);
+    }
+
+    // Whole blocks for cache fills and writebacks, a page at a time
+    void read(long long address, u_int8_t *data, long long size);
+
+    void write(long long address, const u_int8_t *data, long long size);
+
+    static unsigned long long loadLittle(const u_int8_t *p, int bytes)
+    {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        u_int16_t half;
+        u_int32_t word;
+        u_int64_t dword;
+        switch (bytes)
+        {
+        case 1:
+            return p[0];
+        case 2:
+            memcpy(&half, p, 2);
+            return half;
+        case 4:
+            memcpy(&word, p, 4);
+            return word;
+        case 8:
+            memcpy(&dword, p, 8);
+            return dword;
+        }
+#endif
+        unsigned long long value = 0;
+        for (int i = 0; i < bytes; i++)
+            value |= (unsigned long long)p[i] << (8 * i);
+        return value;
+    }
+
+    static void storeLittle(u_int8_t *p, unsigned long long value, int bytes)
+    {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        u_int16_t half = value;
+        u_int32_t word = value;
+        switch (bytes)
+        {
+        case 1:
+            p[0] = value;
+            return;
+        case 2:
+            memcpy(p, &half, 2);
+            return;
+        case 4:
+            memcpy(p, &word, 4);
+            return;
+        case 8:
+            memcpy(p, &value, 8);
+            return;
+        }
+#endif
+        for (int i = 0; i < bytes; i++)
+            p[i] = value >> (8 * i);
+    }
+
+    // Sign or zero extends the low size bits
+    static long long extend(unsigned long long value, int size, bool isSigned)
+    {
+        if (size == 64)
+            return value;
+        if (isSigned)
+            return (long long)(value << (64 - size)) >> (64 - size);
+        return value & ((1ULL << size) - 1);
+    }
+
+    pageTable snapshot();
+
+    std::vector<long long> restore(const pageTable &saved);
+
+    recentPages *recentEntries()
+    {
+        return &recent;
+    }
+
+    void printStats(std::ostream &out);
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef MNEMONICS_GUARD
+#define MNEMONICS_GUARD
+
+#include <array>
+#include <string_view>
+#include <sys/types.h>
+
+// Instruction and register names. Both are looked up in perfect hash tables
+// built at compile time: every name has a slot of its own, so a lookup is one
+// hash of the name and one compare.
+namespace mnemonics
+{
+    struct info
+    {
+        int opcode;
+        int func3;
+        int func7;
+    };
+
+    template <typename T>
+    struct entry
+    {
+        std::string_view name;
+        T value;
+    };
+
+    inline constexpr entry<info> instructions[] = {
+        {"lui", {0b0110111, -1, -1}},
+        {"auipc", {0b0010111, -1, -1}},
+        {"jal", {0b1101111, -1, -1}},
+        {"jalr", {0b1100111, 0x0, -1}},
+        {"beq", {0b1100011, 0x0, -1}},
+        {"bne", {0b1100011, 0x1, -1}},
+        {"blt", {0b1100011, 0x4, -1}},
+        {"bge", {0b1100011, 0x5, -1}},
+        {"bltu", {0b1100011, 0x6, -1}},
+        {"bgeu", {0b1100011, 0x7, -1}},
+        {"lb", {0b0000011, 0x0, -1}},
+        {"lh", {0b0000011, 0x1, -1}},
+        {"lw", {0b0000011, 0x2, -1}},
+        {"ld", {0b0000011, 0x3, -1}},
+        {"lbu", {0b0000011, 0x4, -1}},
+        {"lhu", {0b0000011, 0x5, -1}},
+        {"lwu", {0b0000011, 0x6, -1}},
+        {"sb", {0b0100011, 0x0, -1}},
+        {"sh", {0b0100011, 0x1, -1}},
+        {"sw", {0b0100011, 0x2, -1}},
+        {"sd", {0b0100011, 0x3, -1}},
+        {"addi", {0b0010011, 0x0, -1}},
+        {"slti", {0b0010011, 0x2, -1}},
+        {"sltiu", {0b0010011, 0x3, -1}},
+        {"xori", {0b0010011, 0x4, -1}},
+        {"ori", {0b0010011, 0x6, -1}},
+        {"andi", {0b0010011, 0x7, -1}},
+        {"slli", {0b0010011, 0x1, 0x0}},
+        {"srli", {0b0010011, 0x5, 0x0}},
+        {"srai", {0b0010011, 0x5, 0x10}},
+        {"add", {0b0110011, 0x0, 0x0}},
+        {"sub", {0b0110011, 0x0, 0x20}},
+        {"sll", {0b0110011, 0x1, 0x0}},
+        {"slt", {0b0110011, 0x2, 0x0}},
+        {"sltu", {0b0110011, 0x3, 0x0}},
+        {"xor", {0b0110011, 0x4, 0x0}},
+        {"srl", {0b0110011, 0x5, 0x0}},
+        {"sra", {0b0110011, 0x5, 0x20}},
+        {"or", {0b0110011, 0x6, 0x0}},
+        {"and", {0b0110011, 0x7, 0x0}},
+    };
+
+    // ABI names and x0 to x31
+    inline constexpr entry<int> registers[] = {
+        {"zero", 0}, {"ra", 1}, {"sp", 2}, {"gp", 3}, {"tp", 4}, {"t0", 5}, {"t1", 6}, {"t2", 7}, {"s0", 8}, {"fp", 8}, {"s1", 9}, {"a0", 10}, {"a1", 11}, {"a2", 12}, {"a3", 13}, {"a4", 14}, {"a5",
+        15}, {"a6", 16}, {"a7", 17}, {"s2", 18}, {"s3", 19}, {"s4", 20}, {"s5", 21}, {"s6", 22}, {"s7", 23}, {"s8", 24}, {"s9", 25}, {"s10", 26}, {"s11", 27}, {"t3", 28}, {"t4", 29}, {"t5", 30}, {"t6", 31}, {"x0", 0}, {"x1", 1}, {"x2", 2}, {"x3", 3}, {"x4", 4}, {"x5", 5}, {"x6", 6}, {"x7", 7}, {"x8", 8}, {"x9", 9}, {"x10", 10}, {"x11", 11}, {"x12", 12}, {"x13", 13}, {"x14", 14}, {"x15", 15}, {"x16", 16}, {"x17", 17}, {"x18", 18}, {"x19", 19}, {"x20", 20}, {"x21", 21}, {"x22", 22}, {"x23", 23}, {"x24", 24}, {"x25", 25}, {"x26", 26}, {"x27", 27}, {"x28", 28}, {"x29", 29}, {"x30", 30}, {"x31", 31}};
+
+    constexpr u_int32_t hash(std::string_view name, u_int32_t seed)
+    {
+        for (char c : name)
+            seed = (seed ^ (u_int8_t)c) * 16777619u;
+        return seed;
+    }
+
+    // size is a power of two, a slot with an empty name is free
+    template <typename T, size_t size>
+    struct table
+    {
+        u_int32_t seed;
+        std::array<entry<T>, size> slots;
+
+        constexpr const T *find(std::string_view name) const
+        {
+            const entry<T> &slot = slots[hash(name, seed) & (size - 1)];
+            return !name.empty() && slot.name == name ? &slot.value : nullptr;
+        }
+    };
+
+    // Tries seeds until no two names share a slot
+    template <size_t size, typename T, size_t count>
+    constexpr table<T, size> build(const entry<T> (&entries)[count])
+    {
+        static_assert((size & (size - 1)) == 0, "The table size must be a power of two");
+        for (u_int32_t seed = 2166136261u;; seed++)
+        {
+            table<T, size> t{seed, {}};
+            bool collision = false;
+            for (size_t i = 0; i < count && !collision; i++)
+            {
+                entry<T> &slot = t.slots[hash(entries[i].name, seed) & (size - 1)];
+                collision = !slot.name.empty();
+                slot = entries[i];
+            }
+            if (!collision)
+                return t;
+        }
+    }
+
+    inline constexpr auto instructionTable = build<256>(instructions);
+    inline constexpr auto registerTable = build<512>(registers);
+
+    // nullptr for an unknown mnemonic
+    inline const info *findInstruction(std::string_view name)
+    {
+        return instructionTable.find(name);
+    }
+
+    // -1 for an unknown register
+    inline int findRegister(std::string_view name)
+    {
+        const int *number = registerTable.find(name);
+        return number ? *number : -1;
+    }
+}
+
+#endif
@@ -9,16 +9,18 @@
 #include <vector>
 #include "utilities.hh"
 #include "simulator.hh"
+#include "batch.hh"
 
-int main()
+namespace
 {
-    simulator test;
-    bool loaded = false;
-    while (true)
-    {
-        std::string input, command, errorChecker;
-        getline(std::cin, input);
+    const int maxSourceDepth = 16;
 
+    bool source(simulator &test, bool &loaded, std::string fileName, std::ostream &console, int depth);
+
+    // Runs one REPL command, returns false once the simulator should exit
+    bool execute(simulator &test, bool &loaded, std::string input, std::ostream &console, int depth)
+    {
+        std::string command, errorChecker;
         std::stringstream ss(input);
         ss >> command;
 
@@ -28,7 +30,7 @@ int main()
             ss >> fileName;
             getline(ss, errorChecker);
             if (fileName.empty() || !errorChecker.empty())
-                std::cout << "Invalid Command, Expected: load <filename>" << std::endl;
+                console << "Invalid Command, Expected: load <filename>" << std::endl;
             else
             {
                 test.load(fileName);
@@ -39,7 +41,7 @@ int main()
         {
             getline(ss, errorChecker);
             if (!errorChecker.empty())
-                std::cout << "Invalid Command, Expected: regs" << std::endl;
+                console << "Invalid Command, Expected: regs" << std::endl;
             else
                 test.printRegisters();
         }
@@ -49,7 +51,7 @@ int main()
             ss >> index >> count;
             getline(ss, errorChecker);
             if (index.empty() || count.empty() || !errorChecker.empty())
-                std::cout << "Invalid Command, Expected: mem <index> <count>" << std::endl;
+                console << "Invalid Command, Expected: mem <index> <count>" << std::endl;
             else
                 test.printMemory(index, count);
         }
@@ -57,7 +59,7 @@ int main()
         {
             getline(ss, errorChecker);
             if (!errorChecker.empty())
-                std::cout << "Invalid Command, Expected: show-stack" << std::endl;
+                console << "Invalid Command, Expected: show-stack" << std::endl;
             else
                 test.showStack();
         }
@@ -67,12 +69,12 @@ int main()
             ss >> subCommand >> fileName;
             if (subCommand == "enable")
                 if (loaded)
-                    std::cout << "Cache cannot be enabled after the file is loaded" << std::endl;
+                    console << "Cache cannot be enabled after the file is loaded" << std::endl;
                 else
                     test.enableCache(fileName);
             else if (subCommand == "disable" && fileName == "")
                 if (loaded)
-                    std::cout << "Cache cannot be disabled after the file is loaded" << std::endl;
+                    console << "Cache cannot be disabled after the file is loaded" << std::endl;
                 else
                     test.disableCache();
             else if (subCommand == "status" && fileName.empty())
@@ -84,36 +86,185 @@ int main()
             else if (subCommand == "dump")
                 test.printCache(fileName);
             else
-                std::cout << "Invalid cache command" << std::endl;
+                console << "Invalid cache command" << std::endl;
+        }
+        else if (command == "mode")
+        {
+            std::string mode;
+            ss >> mode;
+            getline(ss, errorChecker);
+            if (mode == "decoded" && errorChecker.empty())
+                test.setExecutionMode(simulator::DECODED);
+            else if (mode == "binary" && errorChecker.empty())
+                test.setExecutionMode(simulator::BINARY);
+            else if (mode == "block" && errorChecker.empty())
+                test.setExecutionMode(simulator::BLOCK);
+            else if (mode == "jit" && errorChecker.empty())
+                test.setExecutionMode(simulator::JIT);
+            else
+                console << "Invalid Command, Expected: mode <decoded|binary|block|jit>" << std::endl;
+        }
+        else if (command == "jit")
+        {
+            std::string subCommand, threshold;
+            ss >> subCommand >> threshold;
+            getline(ss, errorChecker);
+            if (subCommand == "threshold" && !threshold.empty() && errorChecker.empty() && utilities::checkBase10(threshold) && stoll(threshold) > 0 && stoll(threshold) < INT32_MAX)
+                test.setJitThreshold(stoll(threshold));
+            else if (subCommand == "stats" && threshold.empty() && errorChecker.empty())
+                test.printJitStats();
+            else
+                console << "Invalid Command, Expected: jit threshold <count> or jit stats" << std::endl;
+        }
+        else if (command == "memory")
+        {
+            std::string subCommand, size;
+            ss >> subCommand >> size;
+            getline(ss, errorChecker);
+            if (subCommand == "size" && errorChecker.empty() && utilities::parseAddress(size) > 0 && utilities::parseAddress(size) <= 1LL << 48)
+                test.setMemorySize(utilities::parseAddress(size));
+            else if (subCommand == "stats" && size.empty() && errorChecker.empty())
+                test.printMemoryStats();
+            else
+                console << "Invalid Command, Expected: memory size <bytes> or memory stats" << std::endl;
+        }
+        else if (command == "limit")
+        {
+            std::string limit;
+            ss >> limit;
+            getline(ss, errorChecker);
+            if (limit == "off" && errorChecker.empty())
+                test.setInstructionLimit(0);
+            else if (!limit.empty() && errorChecker.empty() && utilities::checkBase10(limit) && limit.size() < 19)
+                test.setInstructionLimit(stoll(limit));
+            else
+                console << "Invalid Command, Expected: limit <count> or limit off" << std::endl;
+        }
+        else if (command == "trace")
+        {
+            std::string fileName;
+            ss >> fileName;
+            getline(ss, errorChecker);
+            if (fileName.empty() || !errorChecker.empty())
+                console << "Invalid Command, Expected: trace <filename> or trace off" << std::endl;
+            else if (fileName == "off")
+                test.stopTrace();
+            else
+                test.startTrace(fileName);
+        }
+        else if (command == "profile")
+        {
+            std::string subCommand, fileName;
+            ss >> subCommand >> fileName;
+            getline(ss, errorChecker);
+            if (subCommand == "on" && fileName.empty() && errorChecker.empty())
+                test.setProfiling(true);
+            else if (subCommand == "off" && fileName.empty() && errorChecker.empty())
+                test.setProfiling(false);
+            else if (subCommand == "report" && errorChecker.empty() && loaded)
+                test.printProfile(fileName);
+            else if (subCommand == "report" && errorChecker.empty())
+                console << "Command Not found or File not loaded" << std::endl;
+            else
+                console << "Invalid Command, Expected: profile <on|off|report [filename]>" << std::endl;
+        }
+        else if (command == "callgraph")
+        {
+            std::string subCommand, fileName;
+            ss >> subCommand >> fileName;
+            getline(ss, errorChecker);
+            if (subCommand == "on" && fileName.empty() && errorChecker.empty())
+                test.setCallGraph(true);
+            else if (subCommand == "off" && fileName.empty() && errorChecker.empty())
+                test.setCallGraph(false);
+            else if (subCommand == "report" && errorChecker.empty() && loaded)
+                test.printCallGraph(fileName);
+            else if (subCommand == "report" && errorChecker.empty())
+                console << "Command Not found or File not loaded" << std::endl;
+            else
+                console << "Invalid Command, Expected: callgraph <on|off|report [filename]>" << std::endl;
+        }
+        else if (command == "stats")
+        {
+            std::string subCommand, fileName;
+            ss >> subCommand >> fileName;
+            getline(ss, errorChecker);
+            if (subCommand.empty())
+                test.printCounters();
+            else if (subCommand == "dump" && !fileName.empty() && errorChecker.empty())
+                test.setCounterDump(fileName);
+            else
+                console << "Invalid Command, Expected: stats or stats dump <filename>" << std::endl;
+        }
+        else if (command == "output")
+        {
+            std::string format;
+            ss >> format;
+            getline(ss, errorChecker);
+            if (format == "json" && errorChecker.empty())
+                test.setJsonOutput(true);
+            else if (format == "text" && errorChecker.empty())
+                test.setJsonOutput(false);
+            else
+                console << "Invalid Command, Expected: output <text|json>" << std::endl;
+        }
+        else if (command == "source")
+        {
+            std::string fileName;
+            ss >> fileName;
+            getline(ss, errorChecker);
+            if (fileName.empty() || !errorChecker.empty())
+                console << "Invalid Command, Expected: source <filename>" << std::endl;
+            else if (depth >= maxSourceDepth)
+                console << "Too many nested source commands" << std::endl;
+            else if (!source(test, loaded, fileName, console, depth + 1))
+                return false;
         }
         else if (command == "exit")
         {
             getline(ss, errorChecker);
             if (!errorChecker.empty())
-                std::cout << "Wrong command: Expected: exit" << std::endl;
+                console << "Wrong command: Expected: exit" << std::endl;
             else
             {
-                std::cout << "Exited the simulator" << std::endl;
-                return 0;
+                console << "Exited the simulator" << std::endl;
+                return false;
             }
         }
         else if (loaded)
         {
             if (command == "run")
+            {
+                std::string option;
+                bool quiet = false, valid = true;
+                long long count = -1;
+                while (ss >> option)
+                    if (option == "--quiet" && !quiet)
+                        quiet = true;
+                    else if (count == -1 && utilities::checkBase10(option) && option.size() < 19)
+                        count = stoll(option);
+                    else
+                        valid = false;
+                if (!valid)
+                    console << "Invalid Command, Expected: run [count] [--quiet]" << std::endl;
+                else
+                    test.run(false, quiet, count);
+            }
+            else if (command == "reload")
             {
                 getline(ss, errorChecker);
                 if (!errorChecker.empty())
-                    std::cout << "Invalid Command, Expected: run" << std::endl;
+                    console << "Invalid Command, Expected: reload" << std::endl;
                 else
-                    test.run(false);
+                    test.reload();
             }
             else if (command == "step")
             {
                 getline(ss, errorChecker);
                 if (!errorChecker.empty())
-                    std::cout << "Invalid Command, Expected: step" << std::endl;
+                    console << "Invalid Command, Expected: step" << std::endl;
                 else
-                    test.run(true);
+                    test.run(true, false, 1);
             }
             else if (command == "break")
             {
@@ -121,10 +272,40 @@ int main()
                 ss >> lineNumber;
                 getline(ss, errorChecker);
 
-                if (lineNumber.empty() || !errorChecker.empty() || !utilities::checkBase10(lineNumber))
-                    std::cout << "Invalid Command, Expected: break <line number>" << std::endl;
-                else
+                if (lineNumber.empty() || !errorChecker.empty())
+                    console << "Invalid Command, Expected: break <line number|label>" << std::endl;
+                else if (utilities::checkBase10(lineNumber))
                     test.addBreakPoint(stoll(lineNumber));
+                else if (test.getLabelLine(lineNumber) < 0)
+                    console << "The Label " << lineNumber << " doesn't exist" << std::endl;
+                else
+                    test.addBreakPoint(test.getLabelLine(lineNumber));
+            }
+            else if (command == "snapshot" || command == "restore")
+            {
+                std::string name;
+                ss >> name;
+                getline(ss, errorChecker);
+
+                if (name.empty() || !errorChecker.empty())
+                    console << "Invalid Command, Expected: " << command << " <name>" << std::endl;
+                else if (command == "snapshot")
+                    test.takeSnapshot(name);
+                else
+                    test.restoreSnapshot(name);
+            }
+            else if (command == "watch")
+            {
+                std::string address, length, access;
+                ss >> address >> length >> access;
+                getline(ss, errorChecker);
+                if (access.empty())
+                    access = "rw";
+
+                if (utilities::parseAddress(address) < 0 || utilities::parseAddress(length) <= 0 || (access != "r" && access != "w" && access != "rw") || !errorChecker.empty())
+                    console << "Invalid Command, Expected: watch <address> <length> [r|w|rw]" << std::endl;
+                else
+                    test.addWatchpoint(utilities::parseAddress(address), utilities::parseAddress(length), access != "w", access != "r");
             }
             else if (command == "del")
             {
@@ -132,13 +313,90 @@ int main()
                 ss >> checkBreak >> lineNumber;
                 getline(ss, errorChecker);
 
-                if (checkBreak != "break" || lineNumber.empty() || !errorChecker.empty() || !utilities::checkBase10(lineNumber))
-                    std::cout << "Invalid Command, Expected: del break <line number>" << std::endl;
-                else
+                if (checkBreak == "watch" && utilities::parseAddress(lineNumber) >= 0 && errorChecker.empty())
+                    test.deleteWatchpoint(utilities::parseAddress(lineNumber));
+                else if (checkBreak != "break" || lineNumber.empty() || !errorChecker.empty())
+                    console << "Invalid Command, Expected: del break <line number|label> or del watch <address>" << std::endl;
+                else if (utilities::checkBase10(lineNumber))
                     test.deleteBreakpoint(stoll(lineNumber));
+                else if (test.getLabelLine(lineNumber) < 0)
+                    console << "The Label " << lineNumber << " doesn't exist" << std::endl;
+                else
+                    test.deleteBreakpoint(test.getLabelLine(lineNumber));
             }
         }
         else
-            std::cout << "Command Not found or File not loaded" << std::endl;
+            console << "Command Not found or File not loaded" << std::endl;
+
+        return true;
+    }
+
+    // Runs every line of a command file, returns false if one of them was exit
+    bool source(simulator &test, bool &loaded, std::string fileName, std::ostream &console, int depth)
+    {
+        std::ifstream input(fileName);
+        if (!input)
+        {
+            console << "Cannot open " << fileName << std::endl;
+            return true;
+        }
+        std::string line;
+        while (getline(input, line))
+            if (!execute(test, loaded, line, console, depth))
+                return false;
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // riscv_sim --batch <jobs file> [-j <threads>] runs without the REPL, and
+    // riscv_sim -x <command file> runs the commands in the file and exits
+    std::string jobsFile, scriptFile;
+    if (argc > 1)
+    {
+        int threads = 1;
+        bool valid = true;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string option = argv[i];
+            if (option == "--batch" && i + 1 < argc && jobsFile.empty())
+                jobsFile = argv[++i];
+            else if (option == "-j" && i + 1 < argc && utilities::checkBase10(argv[i + 1]) && strlen(argv[i + 1]) < 5 && atoi(argv[i + 1]) > 0)
+                threads = atoi(argv[++i]);
+            else if (option == "-x" && i + 1 < argc && scriptFile.empty())
+                scriptFile = argv[++i];
+            else
+                valid = false;
+        }
+        if (!valid || jobsFile.empty() == scriptFile.empty())
+        {
+            std::cout << "Usage: riscv_sim [--batch <jobs file> [-j <threads>]] [-x <command file>]" << std::endl;
+            return 1;
+        }
+        if (!jobsFile.empty())
+            return batch::run(jobsFile, threads);
+    }
+
+    simulator test;
+    bool loaded = false;
+    if (!scriptFile.empty())
+    {
+        // Everything the script prints is collected and written once at the end
+        std::ostringstream buffer;
+        test.setOutput(buffer, std::cerr);
+        if (!std::ifstream(scriptFile))
+        {
+            std::cerr << "Cannot open " << scriptFile << std::endl;
+            return 1;
+        }
+        source(test, loaded, scriptFile, buffer, 0);
+        std::cout << buffer.str() << std::flush;
+        return 0;
     }
-}
\ No newline at end of file
+
+    std::string input;
+    while (getline(std::cin, input))
+        if (!execute(test, loaded, input, std::cout, 0))
+            return 0;
+}
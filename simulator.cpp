@@ -1,91 +1,195 @@
 #include "simulator.hh"
 #include "utilities.hh"
 #include "cache.hh"
+#include "mnemonics.hh"
+#include "elf.hh"
+#include <cstring>
+#include <chrono>
+#include <climits>
+#include <algorithm>
+#include <unistd.h>
 
-struct info
-{
-    int opcode;
-    int func3;
-    int func7;
-};
-
-std::map<std::string, std::string> riscv_registers = {
-    {"zero", "x0"}, {"ra", "x1"}, {"sp", "x2"}, {"gp", "x3"}, {"tp", "x4"}, {"t0", "x5"}, {"t1", "x6"}, {"t2", "x7"}, {"s0", "x8"}, {"fp", "x8"}, {"s1", "x9"}, {"a0", "x10"}, {"a1", "x11"}, {"a2", "x12"}, {"a3", "x13"}, {"a4", "x14"}, {"a5", "x15"}, {"a6", "x16"}, {"a7", "x17"}, {"s2", "x18"}, {"s3", "x19"}, {"s4", "x20"}, {"s5", "x21"}, {"s6", "x22"}, {"s7", "x23"}, {"s8", "x24"}, {"s9", "x25"}, {"s10", "x26"}, {"s11", "x27"}, {"t3", "x28"}, {"t4", "x29"}, {"t5", "x30"}, {"t6", "x31"}};
-
-std::map<std::string, info> riscInfo = {
-    {"lui", {0b0110111, -1, -1}},
-    {"auipc", {0b0010111, -1, -1}},
-    {"jal", {0b1101111, -1, -1}},
-    {"jalr", {0b1100111, 0x0, -1}},
-    {"beq", {0b1100011, 0x0, -1}},
-    {"bne", {0b1100011, 0x1, -1}},
-    {"blt", {0b1100011, 0x4, -1}},
-    {"bge", {0b1100011, 0x5, -1}},
-    {"bltu", {0b1100011, 0x6, -1}},
-    {"bgeu", {0b1100011, 0x7, -1}},
-    {"lb", {0b0000011, 0x0, -1}},
-    {"lh", {0b0000011, 0x1, -1}},
-    {"lw", {0b0000011, 0x2, -1}},
-    {"ld", {0b0000011, 0x3, -1}},
-    {"lbu", {0b0000011, 0x4, -1}},
-    {"lhu", {0b0000011, 0x5, -1}},
-    {"lwu", {0b0000011, 0x6, -1}},
-    {"sb", {0b0100011, 0x0, -1}},
-    {"sh", {0b0100011, 0x1, -1}},
-    {"sw", {0b0100011, 0x2, -1}},
-    {"sd", {0b0100011, 0x3, -1}},
-    {"addi", {0b0010011, 0x0, -1}},
-    {"slti", {0b0010011, 0x2, -1}},
-    {"sltiu", {0b0010011, 0x3, -1}},
-    {"xori", {0b0010011, 0x4, -1}},
-    {"ori", {0b0010011, 0x6, -1}},
-    {"andi", {0b0010011, 0x7, -1}},
-    {"slli", {0b0010011, 0x1, 0x0}},
-    {"srli", {0b0010011, 0x5, 0x0}},
-    {"srai", {0b0010011, 0x5, 0x10}},
-    {"add", {0b0110011, 0x0, 0x0}},
-    {"sub", {0b0110011, 0x0, 0x20}},
-    {"sll", {0b0110011, 0x1, 0x0}},
-    {"slt", {0b0110011, 0x2, 0x0}},
-    {"sltu", {0b0110011, 0x3, 0x0}},
-    {"xor", {0b0110011, 0x4, 0x0}},
-    {"srl", {0b0110011, 0x5, 0x0}},
-    {"sra", {0b0110011, 0x5, 0x20}},
-    {"or", {0b0110011, 0x6, 0x0}},
-    {"and", {0b0110011, 0x7, 0x0}},
-};
+namespace
+{
+    // Same output as std::hex with setw(8) and setfill('0')
+    void appendHex(std::string &s, unsigned long long value)
+    {
+        char digits[16];
+        int count = 0;
+        do
+        {
+            digits[count++] = "0123456789abcdef"[value & 0xf];
+            value >>= 4;
+        } while (value);
+        for (int i = count; i < 8; i++)
+            s += '0';
+        while (count)
+            s += digits[--count];
+    }
+
+    // Every instruction word of an executable gets a line, which bounds where its text may end
+    const long long maxExecutableText = 1LL << 24;
+    // Room left for the stack above the segments of an executable
+    const long long executableStack = 1LL << 20;
+
+    // The part of a line that assembleLine keeps, given the line was read in .data or not
+    std::string_view instructionPart(std::string_view line, bool data)
+    {
+        if (data || (!line.empty() && line[0] == '.'))
+            return std::string_view();
+        size_t index = line.find(':');
+        return index == std::string_view::npos ? line : line.substr(index + 1);
+    }
+
+    // How many lines at the start and at the end of a file are the same
+    // before and after an edit, going by lineHashes without the .data bit
+    void unchangedLines(const std::vector<u_int64_t> &before, const std::vector<u_int64_t> &after, long long &prefix, long long &suffix)
+    {
+        long long oldCount = before.size() - 1, newCount = after.size() - 1;
+        long long common = std::min(oldCount, newCount);
+        prefix = suffix = 0;
+        while (prefix < common && !((before[prefix + 1] ^ after[prefix + 1]) >> 1))
+            prefix++;
+        while (suffix < common - prefix && !((before[oldCount - suffix] ^ after[newCount - suffix]) >> 1))
+            suffix++;
+    }
+
+    // Immediate bits of a branch and of a jal for a byte offset
+    int branchOffset(int offset)
+    {
+        return (((offset & 0b11110) | (offset >> 11 & 0b1)) << 7) + ((((offset >> 5) & 0b111111) | ((offset >> 12 & 0b1) << 6)) << 25);
+    }
+
+    int jumpOffset(int offset)
+    {
+        return (((offset >> 12) & 0b11111111) << 12) + (((offset >> 11) & 0b1) << 20) + (((offset >> 1) & 0b1111111111) << 21) + (((offset >> 20) & 0b1) << 31);
+    }
+
+    // fileName with its extension, if it has one, replaced
+    std::string withExtension(std::string fileName, std::string extension)
+    {
+        size_t dot = fileName.rfind('.'), slash = fileName.rfind('/');
+        return fileName.substr(0, slash == std::string::npos || dot > slash ? dot : std::string::npos) + extension;
+    }
+
+    // How many of the hottest instructions the profile report lists
+    const size_t profileHottest = 10;
+
+    // The last byte is the format version, bump it whenever the layout or the encodings change
+    const char objectMagic[8] = {'R', 'V', 'O', 'B', 'J', 0, 0, 2};
+
+    template <typename T>
+    void put(std::string &object, T value)
+    {
+        object.append((const char *)&value, sizeof(T));
+    }
+
+    // Reads an object file front to back. Reading past the end clears valid
+    // and returns zeros.
+    struct objectReader
+    {
+        std::string_view data;
+        bool valid;
+
+        template <typename T>
+        T get()
+        {
+            T value{};
+            if (data.size() < sizeof(T))
+                valid = false;
+            else
+            {
+                memcpy(&value, data.data(), sizeof(T));
+                data.remove_prefix(sizeof(T));
+            }
+            return value;
+        }
+
+        std::string_view bytes(u_int64_t count)
+        {
+            if (data.size() < count)
+            {
+                valid = false;
+                return std::string_view();
+            }
+            std::string_view value = data.substr(0, count);
+            data.remove_prefix(count);
+            return value;
+        }
+    };
+}
 
 void simulator::reset()
 {
     if (cacheEnabled)
         cacheSim->invalidate(*this);
     PC = 0;
+    textEnd = 0;
+    blocks.clear();
+    recentBlocks.fill(nullptr);
+    codeModified = interrupted = false;
+    jitInstructions = interpretedInstructions = 0;
+    opCounts.fill(0);
+    branchesTaken = 0;
+    runSeconds = 0;
     lineCounter = 1;
-    MC = 0x10000;
+    MC = dataStart;
     error = false;
+    errors.clear();
 
     Stack.clear();
     Stack.push_back({"main", 0});
 
     lines.clear();
-    lines.push_back(std::vector<std::string>{});
+    pcToLine.clear();
+    lineToPC.clear();
+    lineToPC.push_back(0);
+    lineHashes.assign(1, 0);
+    reloadable = false;
+    assembledText.clear();
+    assembledData.clear();
 
     Labels.clear();
+    symbols.clear();
+    executable = false;
     breakPoints.clear();
-    memset(memory, 0, sizeof(memory));
+    breakCounts.clear();
+    breakpointCount = 0;
+    watchpoints.clear();
+    watchedPages.clear();
+    snapshots.clear();
+    ram.clear();
     memset(registers, 0, sizeof(registers));
 }
 
+simulator::~simulator()
+{
+    if (!counterDumpName.empty())
+    {
+        std::ofstream dump(counterDumpName);
+        json = true;
+        out = &dump;
+        printCounters();
+    }
+    delete cacheSim;
+}
+
 void simulator::printError(std::string s)
 {
-    std::cerr << "Line " << lineCounter << ": " << s << std::endl;
+    // While running, lineCounter is only brought up to date when run returns
+    std::string message = "Line " + std::to_string(running ? lineOfPC(PC) : lineCounter) + ": " + s;
+    *err << message << std::endl;
+    errors.push_back(message);
     error = true;
 }
 
-void simulator::checkProperLabel(std::string s)
+void simulator::checkProperLabel(std::string_view s)
 {
     if (s.size() == 0)
+    {
         printError("No Label is provided");
+        return;
+    }
     if (!(utilities::checkIfValueIsInBetween(s[0], 'A', 'Z') || utilities::checkIfValueIsInBetween(s[0], 'a', 'z') || s[0] == '_'))
         printError("Invalid Label Name: A Label should begin only with underscore or alphabet");
     for (auto c : s.substr(1))
@@ -93,780 +197,2330 @@ void simulator::checkProperLabel(std::string s)
             printError("Invalid Label Name: Symbols and spaces can't be used");
 }
 
-long long simulator::loadData(int address, int size, bool isSigned)
+long long simulator::loadData(long long address, int size, bool isSigned)
 {
-    if (address > 0x50000 || address < 0)
+    if (!watchpoints.empty())
+        checkWatchpoints(address, size, false);
+
+    if (!ram.contains(address, size / 8))
         printError("Address Out of range");
     else if (cacheEnabled)
-        return cacheSim->read(*this, address, size, isSigned);
-    else
     {
-        long long data = 0;
-        for (int i = 0; i < size; i += 8)
-            data = data | ((long long)memory[address++] << i);
-
-        if (isSigned && (data >> (size - 1)) == 1)
-            data = data | (~0ULL << size);
-        return data;
+        // A miss is charged to the instruction that made the access
+        long long missed = profiling ? cacheMisses() : 0;
+        long long value = cacheSim->read(*this, address, size, isSigned);
+        if (profiling && running)
+            profileMisses[PC >> 2] += cacheMisses() - missed;
+        return value;
     }
+    else
+        return memory::extend(ram.load(address, size / 8), size, isSigned);
     return 0;
 }
 
-void simulator::storeData(long long data, int address, int size)
+void simulator::storeData(long long data, long long address, int size)
 {
-    if (address > 0x50000 || address < 0)
+    if (!watchpoints.empty())
+        checkWatchpoints(address, size, true);
+
+    if (!ram.contains(address, size / 8))
         printError("Address Out of range");
-    else if (cacheEnabled)
-        cacheSim->write(*this, data, address, size);
     else
-        for (int i = 0; i < size; i = i + 8)
-            memory[address++] = (data >> i) & 0b11111111;
-}
-
-long long simulator::solveImmediateSigned(std::string s, int max)
-{
-    try
     {
-        long long value;
-        if (s[0] == '-' ? s[1] == '0' && s[2] == 'x' && utilities::checkBase16(s.substr(3)) : s[0] == '0' && s[1] == 'x' && utilities::checkBase16(s.substr(2)))
-            value = stoull(s, nullptr, 16);
-        else if (s[0] == '-' ? utilities::checkBase10(s.substr(1)) : utilities::checkBase10(s))
-            value = stoull(s);
-        else
-            printError("Invalid Immediate value");
-        // Check if the value can be stored in given number of bits.
-        if (pow(2, max - 1) > value && value >= -pow(2, max - 1))
-            return value;
+        if (cacheEnabled)
+        {
+            long long missed = profiling ? cacheMisses() : 0;
+            cacheSim->write(*this, data, address, size);
+            if (profiling && running)
+                profileMisses[PC >> 2] += cacheMisses() - missed;
+            // Instruction fetch reads memory, which a write-back cache would
+            // leave stale, so code is also written through. The line stays
+            // dirty and the cache statistics do not change.
+            if (address < textEnd)
+                ram.store(address, data, size / 8);
+        }
         else
-            printError("The Immediate value is too big to fit in " + std::to_string(max) + " bits");
+            ram.store(address, data, size / 8);
+        if (address < textEnd)
+            invalidateCode(address, size);
     }
-    catch (const std::exception &e)
-    {
+}
+
+long long simulator::solveImmediateSigned(std::string_view s, int max)
+{
+    long long value = 0;
+    if (!utilities::isInteger(s))
+        printError("Invalid Immediate value");
+    // Check if the value can be stored in given number of bits.
+    else if (utilities::parseInteger(s, value) && pow(2, max - 1) > value && value >= -pow(2, max - 1))
+        return value;
+    else
         printError("The Immediate value is too big to fit in " + std::to_string(max) + " bits");
-    }
     return 0;
 }
 
-long long simulator::solveImmediateNonNegative(std::string s, int max)
+long long simulator::solveImmediateNonNegative(std::string_view s, int max)
+{
+    long long value = 0;
+    if (!s.empty() && s[0] == '-')
+        printError("The immediate value cannot be negative for this instruction");
+    else if (!utilities::isInteger(s))
+        printError("Invalid Immediate value");
+    // Check if the value can be stored in given number of bits.
+    else if (utilities::parseInteger(s, value) && pow(2, max) > value && value >= 0)
+        return value;
+    else
+        printError("The Immediate value is too big to fit in " + std::to_string(max) + " bits");
+    return 0;
+}
+
+long long simulator::solveDataFromDataSection(std::string_view s, int max)
+{
+    long long value = 0;
+    if (!utilities::isInteger(s))
+        printError("Invalid data value");
+    // Check if the value can be stored in given number of bits.
+    else if (utilities::parseInteger(s, value) && pow(2, max) > value && value >= -pow(2, max - 1))
+        return value;
+    else
+        printError("The value is too big to fit in " + std::to_string(max) + " bits");
+    return 0;
+}
+
+int simulator::solveRegister(std::string_view s)
+{
+    // ABI names and x0 to x31
+    int number = mnemonics::findRegister(s);
+    if (number >= 0)
+        return number;
+    printError(std::string(s) + " is a Invalid register");
+    return 0;
+}
+
+int simulator::encodeInstruction(assembly::tokens v, std::vector<fixup> &fixups)
 {
-    try
+    int encode = 0;
+    // Unknown mnemonics fall through to the error in the default case
+    const mnemonics::info *found = mnemonics::findInstruction(v[0]);
+    const mnemonics::info instruction = found ? *found : mnemonics::info{0, 0, 0};
+
+    switch (instruction.opcode)
     {
-        long long value;
-        if (s[0] == '-')
-            printError("The immediate value cannot be negative for this instruction");
-        else if (s[0] == '0' && s[1] == 'x' && utilities::checkBase16(s.substr(2)))
-            value = stoll(s, nullptr, 16);
-        else if (utilities::checkBase10(s))
-            value = stoll(s);
+    // R type Instructions
+    case 0b0110011:
+        // If number of arguments don't match
+        if (v.size() != 4)
+            printError("Wrong arguments: Expected rd, rs1, rs2");
+        encode += 0b0110011;
+        encode += instruction.func3 << 12;
+        encode += instruction.func7 << 25;
+        encode += solveRegister(v[1]) << 7;
+        encode += solveRegister(v[2]) << 15;
+        encode += solveRegister(v[3]) << 20;
+        break;
+
+    // I Type Instructions (Arthemetic)
+    case 0b0010011:
+        // If number of arguments don't match
+        if (v.size() != 4)
+            printError("Wrong arguments: Expected rd, rs1, imm");
+        encode += 0b0010011;
+        encode += instruction.func3 << 12;
+        encode += solveRegister(v[1]) << 7;
+        encode += solveRegister(v[2]) << 15;
+        // For srai,srli,slli as they have func6 parameters
+        if (instruction.func7 != -1)
+        {
+            encode += solveImmediateNonNegative(v[3], 6) << 20;
+            encode += instruction.func7 << 26;
+        }
         else
-            printError("Invalid Immediate value");
-        // Check if the value can be stored in given number of bits.
-        if (pow(2, max) > value && value >= 0)
-            return value;
+            encode += solveImmediateSigned(v[3], 12) << 20;
+        break;
+    // I type Instructions (Load instructions)
+    case 0b0000011:
+        encode += 0b0000011;
+        encode += instruction.func3 << 12;
+        encode += solveRegister(v[1]) << 7;
+        if (v.size() == 4)
+        {
+            encode += solveRegister(v[3]) << 15;
+            encode += solveImmediateSigned(v[2], 12) << 20;
+        }
+        else if (v.size() == 3)
+        {
+            int start = v[2].find('(');
+            int end = v[2].find(')');
+            if (start == std::string_view::npos || end == std::string_view::npos)
+                printError("Wrong arguments: Expected rd, imm, rs1 or rd, imm(rs1)");
+            encode += solveRegister(v[2].substr(start + 1, end - start - 1)) << 15;
+            encode += solveImmediateSigned(v[2].substr(0, start), 12) << 20;
+        }
+        else
+            printError("Wrong arguments: Expected rd, imm, rs1 or rd, imm(rs1)");
+        break;
 
-        printError("The Immediate value is too big to fit in " + std::to_string(max) + " bits");
-    }
-    catch (const std::exception &e)
-    {
-        printError("The Immediate value is too big to fit in " + std::to_string(max) + " bits");
+    // S type instructions
+    case 0b0100011:
+        encode += 0b0100011;
+        encode += instruction.func3 << 12;
+        encode += solveRegister(v[1]) << 20;
+        if (v.size() == 4)
+        {
+            encode += solveRegister(v[3]) << 15;
+            int immediate = solveImmediateSigned(v[2], 12);
+            encode += (immediate & 0b11111) << 7;
+            encode += (immediate >> 5) << 25;
+        }
+        else if (v.size() == 3)
+        {
+            int start = v[2].find('(');
+            int end = v[2].find(')');
+            if (start == std::string_view::npos || end == std::string_view::npos)
+                printError("Wrong arguments: Expected rd, imm, rs1 or rd, imm(rs1)");
+            encode += solveRegister(v[2].substr(start + 1, end - start - 1)) << 15;
+            int immediate = solveImmediateSigned(v[2].substr(0, start), 12);
+            encode += (immediate & 0b11111) << 7;
+            encode += (immediate >> 5) << 25;
+        }
+        else
+            printError("Wrong arguments : Expected rs2, imm, rs1 or rs2, imm(rs1)");
+        break;
+
+    // B type instruction
+    case 0b1100011:
+        if (v.size() != 4)
+            printError("Wrong arguments: Expected rs1, rs2, imm");
+        encode += 0b1100011;
+        encode += instruction.func3 << 12;
+        encode += solveRegister(v[1]) << 15;
+        encode += solveRegister(v[2]) << 20;
+        if (utilities::isInteger(v[3]))
+            encode += branchOffset(solveImmediateSigned(v[3], 13));
+        else
+            fixups.push_back({PC, lineCounter, v[3], encode, false});
+        break;
+
+    // JAL instruction
+    case 0b1101111:
+        if (v.size() != 3)
+            printError("Invalid Arguments: Expected jal rd, imm");
+        encode += 0b1101111;
+        encode += solveRegister(v[1]) << 7;
+        if (utilities::isInteger(v[2]))
+            encode += jumpOffset(solveImmediateSigned(v[2], 21));
+        else
+            fixups.push_back({PC, lineCounter, v[2], encode, true});
+        break;
+
+    // JALR Instruction
+    case 0b1100111:
+        encode += 0b1100111;
+        encode += instruction.func3 << 12;
+        encode += solveRegister(v[1]) << 7;
+        if (v.size() == 4)
+        {
+            encode += solveRegister(v[2]) << 15;
+            encode += solveImmediateSigned(v[3], 12) << 20;
+        }
+        else if (v.size() == 3)
+        {
+            int start = v[2].find('(');
+            int end = v[2].find(')');
+            if (start == std::string_view::npos || end == std::string_view::npos)
+                printError("Wrong arguments: Expected jalr rd, rs1, imm or jalr rd, imm(rs1)");
+            encode += solveRegister(v[2].substr(start + 1, end - start - 1)) << 15;
+            encode += solveImmediateSigned(v[2].substr(0, start), 12) << 20;
+        }
+        else
+            printError("Wrong arguments: Expected jalr rd, rs1, imm or jalr rd, imm(rs1)");
+        break;
+
+    // LUI Instruction
+    case 0b0110111:
+        if (v.size() != 3)
+            printError("Wrong arguments: Expected lui rs1, imm");
+
+        encode += 0b0110111;
+        encode += solveRegister(v[1]) << 7;
+        encode += solveImmediateNonNegative(v[2], 20) << 12;
+        break;
+
+    default:
+        printError("The instruction " + std::string(v[0]) + " doesn't exist");
     }
-    return 0;
+    return encode;
 }
 
-long long simulator::solveDataFromDataSection(std::string s, int max)
+void simulator::assembleLine(std::string_view line, std::vector<fixup> &fixups)
 {
-    try
+    size_t index = line.find(':');
+    if (index != std::string_view::npos)
     {
-        long long value;
-        if (s[0] == '-' ? s[1] == '0' && s[2] == 'x' && utilities::checkBase16(s.substr(3)) : s[0] == '0' && s[1] == 'x' && utilities::checkBase16(s.substr(2)))
-            value = stoull(s, nullptr, 16);
-        else if (s[0] == '-' ? utilities::checkBase10(s.substr(1)) : utilities::checkBase10(s))
-            value = stoull(s);
-        else
-            printError("Invalid data value");
-        // Check if the value can be stored in given number of bits.
-        if (pow(2, max) > value && value >= -pow(2, max - 1))
-            return value;
+        std::string_view label = line.substr(0, index);
+        // checks for duplicate Labels
+        if (Labels.find(label) == Labels.end())
+        {
+            checkProperLabel(label);
+            Labels.insert({std::string(label), {PC, lineCounter}});
+            if (label == "main")
+                Stack[0].second = lineCounter - 1;
+        }
         else
-            printError("The value is too big to fit in " + std::to_string(max) + " bits");
+            printError("Duplicate Label name");
+        line = line.substr(index + 1);
     }
-    catch (const std::exception &e)
+    lines.addLine(line);
+    // Lines without an instruction map to the PC of the next instruction
+    lineToPC.push_back(PC);
+    // If no instruction follows the label or line empty, PC is not updated
+    if (!lines[lineCounter].empty())
     {
-        printError("The value is too big to fit in " + std::to_string(max) + " bits");
+        pcToLine.push_back(lineCounter);
+        storeData(encodeInstruction(lines[lineCounter], fixups), PC, 32);
+        PC += 4;
     }
-    return 0;
 }
 
-int simulator::solveRegister(std::string s)
+void simulator::resolveFixups(const std::vector<fixup> &fixups)
 {
-    // Check if the register is alias to some register
-    auto index = riscv_registers.find(s);
-    if (index != riscv_registers.end())
-        s = index->second;
-
-    if (s[0] == 'x' && utilities::checkIfValueIsInBetween(s[1], '0', '9') && (s.size() == 3 ? (s[1] != '0' && utilities::checkIfValueIsInBetween(s[1], '1', '9')) : 1))
+    for (const fixup &f : fixups)
     {
-        int ans;
-        if (s.size() == 2)
-            ans = s[1] - '0';
+        lineCounter = f.line;
+        auto index = Labels.find(f.label);
+        if (index == Labels.end())
+            printError(f.jump ? "The Label " + std::string(f.label) + " doesn't exist" : " The Label " + std::string(f.label) + " doesn't exist");
         else
-            ans = (s[1] - '0') * 10 + s[2] - '0';
-        if (ans < 32)
-            return ans;
+        {
+            int offset = index->second.first - f.PC;
+            storeData(f.encode + (f.jump ? jumpOffset(offset) : branchOffset(offset)), f.PC, 32);
+        }
     }
-    printError(s + " is a Invalid register");
-    return 0;
+    lineCounter = lines.size();
 }
 
-void simulator::preprocess(std::string s)
+void simulator::storeInstructions()
 {
-    std::ifstream inputFile(s);
-    std::string line;
-    while (getline(inputFile, line))
+    // A single pass over the mapped file. Data and instructions are stored as
+    // they are read, and branches to labels further down are patched at the end.
+    std::vector<fixup> fixups;
+    std::vector<std::string_view> v;
+    std::string_view line;
+    bool data = false;
+    while (lines.nextLine(line))
     {
-        utilities::format(line);
-        std::vector<std::string> v;
-        if (line[0] == '.')
+        lineCounter = lines.size();
+        lineHashes.push_back(assembly::hash(line) << 1 | data);
+        if (data)
         {
-            if (line == ".data")
-            {
-                lines.push_back(v);
-                lineCounter++;
-                while (getline(inputFile, line))
+            lines.addLine(std::string_view());
+            lineToPC.push_back(PC);
+            if (line.empty())
+                continue;
+
+            v.clear();
+            assembly::split(line, v);
+            std::string_view type = v.empty() ? std::string_view() : v[0];
+            int size = type == ".dword" ? 64 : type == ".word" ? 32 : type == ".half" ? 16 : type == ".byte" ? 8 : 0;
+            if (size)
+                for (size_t i = 1; i < v.size(); i++)
                 {
-                    lines.push_back(v);
-                    utilities::format(line);
-                    if (line.empty())
-                        continue;
-
-                    std::stringstream ss(line);
-                    std::string type;
-                    ss >> type;
-
-                    if (type == ".dword")
-                        while (ss >> type)
-                        {
-                            storeData(solveDataFromDataSection(type, 64), MC, 64);
-                            MC += 8;
-                        }
-                    else if (type == ".word")
-                        while (ss >> type)
-                        {
-                            storeData(solveDataFromDataSection(type, 32), MC, 32);
-                            MC += 4;
-                        }
-                    else if (type == ".half")
-                        while (ss >> type)
-                        {
-                            storeData(solveDataFromDataSection(type, 16), MC, 16);
-                            MC += 2;
-                        }
-                    else if (type == ".byte")
-                        while (ss >> type)
-                        {
-                            storeData(solveDataFromDataSection(type, 8), MC, 8);
-                            MC += 1;
-                        }
-                    else if (type == ".text")
-                    {
-                        lineCounter++;
-                        break;
-                    }
-                    else
-                        printError("Invalid directive inside .data");
-                    lineCounter++;
+                    storeData(solveDataFromDataSection(v[i], size), MC, size);
+                    MC += size / 8;
                 }
-            }
-            else if (line == ".text")
-            {
-                lines.push_back(v);
-                lineCounter++;
-            }
+            else if (type == ".text")
+                data = false;
             else
-                printError("Illegal directives");
+                printError("Invalid directive inside .data");
         }
-        else
+        else if (!line.empty() && line[0] == '.')
         {
-            long long index = line.find(':');
-            if (index != std::string::npos)
-            {
-                // checks for duplicate Labels
-                if (Labels.find(line.substr(0, index)) == Labels.end())
-                {
-                    checkProperLabel(line.substr(0, index));
-                    Labels.insert({line.substr(0, index), {PC, lineCounter}});
-                    if (line.substr(0, index) == "main")
-                        Stack[0].second = lineCounter - 1;
-                }
-                else
-                    printError("Duplicate Label name");
-            }
-            else
-                index = -1;
-            utilities::spiltLineIntoWords(line.substr(index + 1), v);
-            lines.push_back(v);
-            // If no instruction follows the label or line empty, PC is not updated
-            if (index != line.size() - 1)
-                PC += 4;
-            lineCounter++;
+            lines.addLine(std::string_view());
+            lineToPC.push_back(PC);
+            if (line == ".data")
+                data = true;
+            else if (line != ".text")
+                printError("Illegal directives");
         }
+        else
+            assembleLine(line, fixups);
     }
-    inputFile.close();
+    resolveFixups(fixups);
 }
 
-void simulator::storeInstructions(std::string fileName)
+bool simulator::assembleChanges()
 {
-    preprocess(fileName);
-    lineCounter = 1;
-    PC = 0;
-    while (lineCounter < lines.size())
+    if (!reloadable)
+        return false;
+    assembly source;
+    if (!source.map(fileName) || elf::isElf(source.text()))
+        return false;
+    std::vector<std::string_view> text(1);
+    std::vector<u_int64_t> hashes(1, 0);
+    text.reserve(lineHashes.size() + 64);
+    hashes.reserve(lineHashes.size() + 64);
+    std::string_view line;
+    while (source.nextLine(line))
     {
-        std::vector<std::string> v = lines[lineCounter];
-        if (v.empty())
-        {
-            lineCounter++;
-            continue;
-        }
-
-        int encode = 0;
-        std::map<std::string, std::pair<long long, long long>>::iterator index;
-
-        switch (riscInfo[v[0]].opcode)
-        {
-        // R type Instructions
-        case 0b0110011:
-            // If number of arguments don't match
-            if (v.size() != 4)
-                printError("Wrong arguments: Expected rd, rs1, rs2");
-            encode += 0b0110011;
-            encode += riscInfo[v[0]].func3 << 12;
-            encode += riscInfo[v[0]].func7 << 25;
-            encode += solveRegister(v[1]) << 7;
-            encode += solveRegister(v[2]) << 15;
-            encode += solveRegister(v[3]) << 20;
-            break;
+        text.push_back(line);
+        hashes.push_back(assembly::hash(line) << 1);
+    }
 
-        // I Type Instructions (Arthemetic)
-        case 0b0010011:
-            // If number of arguments don't match
-            if (v.size() != 4)
-                printError("Wrong arguments: Expected rd, rs1, imm");
-            encode += 0b0010011;
-            encode += riscInfo[v[0]].func3 << 12;
-            encode += solveRegister(v[1]) << 7;
-            encode += solveRegister(v[2]) << 15;
-            // For srai,srli,slli as they have func6 parameters
-            if (riscInfo[v[0]].func7 != -1)
-            {
-                encode += solveImmediateNonNegative(v[3], 6) << 20;
-                encode += riscInfo[v[0]].func7 << 26;
-            }
-            else
-                encode += solveImmediateSigned(v[3], 12) << 20;
-            break;
-        // I type Instructions (Load instructions)
-        case 0b0000011:
-            encode += 0b0000011;
-            encode += riscInfo[v[0]].func3 << 12;
-            encode += solveRegister(v[1]) << 7;
-            if (v.size() == 4)
-            {
-                encode += solveRegister(v[3]) << 15;
-                encode += solveImmediateSigned(v[2], 12) << 20;
-            }
-            else if (v.size() == 3)
-            {
-                int start = v[2].find('(');
-                int end = v[2].find(')');
-                if (start == std::string::npos || end == std::string::npos)
-                    printError("Wrong arguments: Expected rd, imm, rs1 or rd, imm(rs1)");
-                encode += solveRegister(v[2].substr(start + 1, end - start - 1)) << 15;
-                encode += solveImmediateSigned(v[2].substr(0, start), 12) << 20;
-            }
-            else
-                printError("Wrong arguments: Expected rd, imm, rs1 or rd, imm(rs1)");
-            break;
+    // The edit replaces old lines prefix + 1 to oldEnd with new lines prefix + 1 to newEnd
+    long long prefix, suffix;
+    unchangedLines(lineHashes, hashes, prefix, suffix);
+    long long oldCount = lineHashes.size() - 1, newCount = hashes.size() - 1;
+    long long oldEnd = oldCount - suffix, newEnd = newCount - suffix;
 
-        // S type instructions
-        case 0b0100011:
-            encode += 0b0100011;
-            encode += riscInfo[v[0]].func3 << 12;
-            encode += solveRegister(v[1]) << 20;
-            if (v.size() == 4)
-            {
-                encode += solveRegister(v[3]) << 15;
-                int immediate = solveImmediateSigned(v[2], 12);
-                encode += (immediate & 0b11111) << 7;
-                encode += (immediate >> 5) << 25;
-            }
-            else if (v.size() == 3)
-            {
-                int start = v[2].find('(');
-                int end = v[2].find(')');
-                if (start == std::string::npos || end == std::string::npos)
-                    printError("Wrong arguments: Expected rd, imm, rs1 or rd, imm(rs1)");
-                encode += solveRegister(v[2].substr(start + 1, end - start - 1)) << 15;
-                int immediate = solveImmediateSigned(v[2].substr(0, start), 12);
-                encode += (immediate & 0b11111) << 7;
-                encode += (immediate >> 5) << 25;
-            }
-            else
-                printError("Wrong arguments : Expected rs2, imm, rs1 or rs2, imm(rs1)");
-            break;
+    // It has to be plain .text: read in .text before and after, with no
+    // directive in the new lines, and the lines behind it read in .text too
+    bool data = false;
+    if (prefix > 0)
+    {
+        std::vector<std::string_view> v;
+        assembly::split(text[prefix], v);
+        data = lineHashes[prefix] & 1 ? v.empty() || v[0] != ".text" : text[prefix] == ".data";
+    }
+    for (long long l = prefix + 1; l <= oldEnd + 1 && l <= oldCount; l++)
+        data = data || (lineHashes[l] & 1);
+    for (long long l = prefix + 1; l <= newEnd; l++)
+        data = data || (!text[l].empty() && text[l][0] == '.');
+    if (data)
+        return false;
 
-        // B type instruction
-        case 0b1100011:
-            if (v.size() != 4)
-                printError("Wrong arguments: Expected rs1, rs2, imm");
-            encode += 0b1100011;
-            encode += riscInfo[v[0]].func3 << 12;
-            encode += solveRegister(v[1]) << 15;
-            encode += solveRegister(v[2]) << 20;
-            index = Labels.find(v[3]);
-            if (index != Labels.end())
-            {
-                int offset = index->second.first - PC;
-                encode += ((offset & 0b11110) | (offset >> 11 & 0b1)) << 7;
-                encode += (((offset >> 5) & 0b111111) | ((offset >> 12 & 0b1) << 6)) << 25;
-            }
-            else if ((v[3][0] == '-' ? utilities::checkBase10(v[3].substr(1)) : utilities::checkBase10(v[3])) || (v[3][0] == '-' ? v[3][1] == '0' && v[3][2] == 'x' && utilities::checkBase16(v[3].substr(3)) : v[3][0] == '0' && v[3][1] == 'x' && utilities::checkBase16(v[3].substr(2))))
-            {
-                int offset = solveImmediateSigned(v[3], 13);
-                encode += ((offset & 0b11110) | (offset >> 11 & 0b1)) << 7;
-                encode += (((offset >> 5) & 0b111111) | ((offset >> 12 & 0b1) << 6)) << 25;
-            }
-            else
-                printError(" The Label " + v[3] + " doesn't exist");
-            break;
+    // What the splice needs of the old load, before reset clears it
+    std::vector<long long> oldLineToPC = std::move(lineToPC), oldPcToLine = std::move(pcToLine);
+    std::vector<u_int64_t> oldHashes = std::move(lineHashes);
+    std::vector<decoder::instruction> oldProgram = std::move(program);
+    std::vector<u_int8_t> oldText = std::move(assembledText), oldData = std::move(assembledData);
+    auto labels = std::move(Labels);
+    long long oldMC = MC;
+    auto oldPCOfLine = [&](long long line)
+    {
+        return line < oldLineToPC.size() ? oldLineToPC[line] : (long long)oldPcToLine.size() * 4;
+    };
+    long long editStart = oldPCOfLine(prefix + 1), editEnd = oldPCOfLine(oldEnd + 1), lineShift = newEnd - oldEnd;
 
-        // JAL instruction
-        case 0b1101111:
-            if (v.size() != 3)
-                printError("Invalid Arguments: Expected jal rd, imm");
-            encode += 0b1101111;
-            encode += solveRegister(v[1]) << 7;
-            index = Labels.find(v[2]);
-            if (index != Labels.end())
-            {
-                int offset = index->second.first - PC;
-                encode += ((offset >> 12) & 0b11111111) << 12;
-                encode += ((offset >> 11) & 0b1) << 20;
-                encode += ((offset >> 1) & 0b1111111111) << 21;
-                encode += ((offset >> 20) & 0b1) << 31;
-            }
-            else if ((v[2][0] == '-' ? utilities::checkBase10(v[2].substr(1)) : utilities::checkBase10(v[2])) || (v[2][0] == '-' ? v[2][1] == '0' && v[2][2] == 'x' && utilities::checkBase16(v[2].substr(3)) : v[2][0] == '0' && v[2][1] == 'x' && utilities::checkBase16(v[2].substr(2))))
-            {
-                int offset = solveImmediateSigned(v[2], 21);
-                encode += ((offset >> 12) & 0b11111111) << 12;
-                encode += ((offset >> 11) & 0b1) << 20;
-                encode += ((offset >> 1) & 0b1111111111) << 21;
-                encode += ((offset >> 20) & 0b1) << 31;
-            }
-            else
-                printError("The Label " + v[3] + " doesn't exist");
-            break;
+    bool cache = beginLoad();
+    lines.swap(source);
+    // Errors are left for the full load that follows to report in order
+    std::ostream *console = err;
+    err = &discard;
+    MC = oldMC;
+    ram.write(dataStart, oldData.data(), oldData.size());
 
-        // JALR Instruction
-        case 0b1100111:
-            encode += 0b1100111;
-            encode += riscInfo[v[0]].func3 << 12;
-            encode += solveRegister(v[1]) << 7;
-            if (v.size() == 4)
-            {
-                encode += solveRegister(v[2]) << 15;
-                encode += solveImmediateSigned(v[3], 12) << 20;
-            }
-            else if (v.size() == 3)
-            {
-                int start = v[2].find('(');
-                int end = v[2].find(')');
-                if (start == std::string::npos || end == std::string::npos)
-                    printError("Wrong arguments: Expected jalr rd, rs1, imm or jalr rd, imm(rs1)");
-                encode += solveRegister(v[2].substr(start + 1, end - start - 1)) << 15;
-                encode += solveImmediateSigned(v[2].substr(0, start), 12) << 20;
-            }
-            else
-                printError("Wrong arguments: Expected jalr rd, rs1, imm or jalr rd, imm(rs1)");
-            break;
+    // The lines in front of the edit stay as they were
+    lines.reserve(newCount + 1);
+    lineToPC.reserve(newCount + 1);
+    lineHashes.reserve(newCount + 1);
+    for (long long l = 1; l <= prefix; l++)
+        lines.addLine(instructionPart(text[l], oldHashes[l] & 1));
+    lineToPC.assign(oldLineToPC.begin(), oldLineToPC.begin() + prefix + 1);
+    lineHashes.assign(oldHashes.begin(), oldHashes.begin() + prefix + 1);
+    pcToLine.assign(oldPcToLine.begin(), oldPcToLine.begin() + editStart / 4);
+    ram.write(0, oldText.data(), editStart);
+    Labels = std::move(labels);
+    for (auto label = Labels.begin(); label != Labels.end();)
+    {
+        if (label->second.second > prefix && label->second.second <= oldEnd)
+            label = Labels.erase(label);
+        else
+        {
+            if (label->second.second > oldEnd)
+                label->second.second += lineShift;
+            ++label;
+        }
+    }
 
-        // LUI Instruction
-        case 0b0110111:
-            if (v.size() != 3)
-                printError("Wrong arguments: Expected lui rs1, imm");
+    PC = editStart;
+    std::vector<fixup> fixups;
+    for (long long l = prefix + 1; l <= newEnd; l++)
+    {
+        lineCounter = lines.size();
+        lineHashes.push_back(hashes[l]);
+        assembleLine(text[l], fixups);
+    }
 
-            encode += 0b0110111;
-            encode += solveRegister(v[1]) << 7;
-            encode += solveImmediateNonNegative(v[2], 20) << 12;
-            break;
+    // and the lines behind it move as a whole
+    long long shift = PC - editEnd;
+    for (long long l = newEnd + 1; l <= newCount; l++)
+    {
+        long long old = l - lineShift;
+        lines.addLine(instructionPart(text[l], oldHashes[old] & 1));
+        lineToPC.push_back(oldLineToPC[old] + shift);
+        lineHashes.push_back(oldHashes[old]);
+    }
+    for (size_t i = editEnd / 4; i < oldPcToLine.size(); i++)
+        pcToLine.push_back(oldPcToLine[i] + lineShift);
+    ram.write(PC, oldText.data() + editEnd, oldText.size() - editEnd);
+    // Whatever the old text left past the new end reads as zero again
+    for (long long address = oldText.size() + shift; address < (long long)oldText.size(); address++)
+        ram.writeByte(address, 0);
+    for (auto &label : Labels)
+        if (label.second.second > newEnd)
+            label.second.first += shift;
+    auto main = Labels.find("main");
+    if (main != Labels.end())
+        Stack[0].second = main->second.second - 1;
 
-        default:
-            printError("The instruction " + v[0] + " doesn't exist");
+    // Jumps and branches outside the edit keep their encoding unless their
+    // target moved relative to them. A target inside the edit may have lost
+    // its label, so anything jumping there is assembled again.
+    for (size_t i = 0; i < oldProgram.size(); i++)
+    {
+        const decoder::instruction &ins = oldProgram[i];
+        long long oldPC = i * 4;
+        if ((oldPC >= editStart && oldPC < editEnd) || (ins.op != decoder::JAL && (ins.op < decoder::BEQ || ins.op > decoder::BGEU)))
+            continue;
+        long long newPC = oldPC < editStart ? oldPC : oldPC + shift;
+        long long target = ins.target < editStart ? ins.target : ins.target + shift;
+        if ((ins.target >= editStart && ins.target <= editEnd) || target - newPC != ins.target - oldPC)
+        {
+            long long end = PC;
+            PC = newPC;
+            lineCounter = pcToLine[newPC >> 2];
+            storeData(encodeInstruction(lines[lineCounter], fixups), newPC, 32);
+            PC = end;
         }
-        storeData(encode, PC, 32);
-        PC += 4;
-        lineCounter++;
     }
+    // Missing labels are reported in line order, as a full pass would
+    std::stable_sort(fixups.begin(), fixups.end(), [](const fixup &a, const fixup &b)
+                     { return a.line < b.line; });
+    resolveFixups(fixups);
+
+    err = console;
+    if (error)
+    {
+        cacheEnabled = cache;
+        return false;
+    }
+    finishLoad(cache, 0);
+    return true;
 }
 
-long long simulator::findLineNumberWrtPC(long long PC)
+void simulator::saveObject(std::string objectName, u_int64_t hash)
 {
-    int dummyPC = 0;
-    int lineNumber = 1;
-    while (dummyPC != PC && lineNumber < lines.size())
-        if (!lines[lineNumber++].empty())
-            dummyPC += 4;
+    // Memory is saved as the text and data ranges, or as one range when a
+    // long text runs into the data
+    long long textSize = pcToLine.size() * 4;
+    std::vector<std::pair<long long, long long>> ranges = {{0, textSize}, {dataStart, MC - dataStart}};
+    if (MC > dataStart && textSize > dataStart)
+        ranges = {{0, std::max(textSize, MC)}};
+
+    std::string_view source = lines.text();
+    std::string object(objectMagic, sizeof(objectMagic));
+    put<u_int64_t>(object, source.size());
+    put<u_int64_t>(object, hash);
+    put<u_int64_t>(object, ranges.size());
+    for (auto &range : ranges)
+    {
+        put<long long>(object, range.first);
+        put<long long>(object, range.second);
+        object.resize(object.size() + range.second);
+        ram.read(range.first, (u_int8_t *)&object[object.size() - range.second], range.second);
+    }
+
+    put<u_int64_t>(object, Labels.size());
+    for (auto &label : Labels)
+    {
+        put<u_int32_t>(object, label.first.size());
+        object += label.first;
+        put<long long>(object, label.second.first);
+        put<long long>(object, label.second.second);
+    }
+
+    // Every line as the part of the source that holds its instruction, empty
+    // for lines without one, and its hash
+    put<u_int64_t>(object, lines.size());
+    for (size_t line = 1; line < lines.size(); line++)
+    {
+        long long PC = lineToPC[line];
+        bool instruction = PC < pcToLine.size() * 4 && pcToLine[PC >> 2] == line;
+        put<u_int32_t>(object, instruction ? lines.lineText(line).data() - source.data() : 0);
+        put<u_int32_t>(object, instruction ? lines.lineText(line).size() : 0);
+        put<u_int64_t>(object, lineHashes[line]);
+    }
 
-    return lineNumber;
+    // Written under a name of its own and renamed, so that simulators loading
+    // the same source at the same time never see half a file
+    std::string temporary = objectName + ".tmp" + std::to_string(getpid()) + "." + std::to_string((uintptr_t)this);
+    std::ofstream output(temporary, std::ios::binary);
+    output.write(object.data(), object.size());
+    output.close();
+    if (!output || rename(temporary.c_str(), objectName.c_str()) != 0)
+        remove(temporary.c_str());
 }
 
-void simulator::run(bool step)
+bool simulator::loadObject(std::string objectName, u_int64_t hash)
 {
-    if (error)
+    std::ifstream input(objectName, std::ios::binary | std::ios::ate);
+    if (!input)
+        return false;
+    std::string object(input.tellg(), '\0');
+    input.seekg(0);
+    input.read(&object[0], object.size());
+    objectReader reader{object, true};
+    std::string_view source = lines.text();
+    if (reader.bytes(sizeof(objectMagic)) != std::string_view(objectMagic, sizeof(objectMagic)) || reader.get<u_int64_t>() != source.size() || reader.get<u_int64_t>() != hash)
+        return false;
+
+    u_int64_t rangeCount = reader.get<u_int64_t>();
+    std::vector<std::pair<long long, std::string_view>> ranges(rangeCount <= 2 ? rangeCount : 0);
+    for (auto &range : ranges)
     {
-        std::cout << "File not loaded as there is some error in the file" << std::endl;
-        return;
+        range.first = reader.get<long long>();
+        range.second = reader.bytes(reader.get<long long>());
+        if (!ram.contains(range.first, range.second.size()))
+            reader.valid = false;
     }
 
-    if (lineCounter >= lines.size())
-        if (step)
-            std::cout << "Nothing to step" << std::endl;
-        else
-            std::cout << "Nothing to run" << std::endl;
-    else
-        do
-        {
-            auto checkbreakPoint = breakPoints.find(lineCounter);
-            if (!step && checkbreakPoint != breakPoints.end())
-            {
-                std::cout << "Execution stopped at breakpoint" << std::endl;
-                break;
-            }
+    std::map<std::string, std::pair<long long, long long>, std::less<>> labels;
+    for (u_int64_t count = reader.get<u_int64_t>(); count && reader.valid; count--)
+    {
+        std::string name(reader.bytes(reader.get<u_int32_t>()));
+        long long address = reader.get<long long>();
+        labels[name] = {address, reader.get<long long>()};
+    }
 
-            std::vector<std::string> v = lines[lineCounter];
-            while (v.empty() && lineCounter < lines.size())
-                v = lines[++lineCounter];
+    std::vector<std::string_view> instructions;
+    std::vector<u_int64_t> hashes(1, 0);
+    u_int64_t lineCount = reader.get<u_int64_t>();
+    for (u_int64_t line = 1; line < lineCount && reader.valid; line++)
+    {
+        u_int32_t offset = reader.get<u_int32_t>();
+        u_int32_t length = reader.get<u_int32_t>();
+        if (offset > source.size() || length > source.size() - offset)
+            reader.valid = false;
+        instructions.push_back(source.substr(std::min<size_t>(offset, source.size()), length));
+        hashes.push_back(reader.get<u_int64_t>());
+    }
+    if (!reader.valid || !reader.data.empty())
+        return false;
 
-            Stack[Stack.size() - 1].second = lineCounter;
+    // The whole object checked out, only now does the simulator change. The
+    // last range ends where the data does.
+    for (auto &range : ranges)
+        ram.write(range.first, (const u_int8_t *)range.second.data(), range.second.size());
+    if (!ranges.empty())
+        MC = std::max(dataStart, ranges.back().first + (long long)ranges.back().second.size());
+    Labels = std::move(labels);
+    lineHashes = std::move(hashes);
+    auto main = Labels.find("main");
+    if (main != Labels.end())
+        Stack[0].second = main->second.second - 1;
+    for (std::string_view instruction : instructions)
+    {
+        lineToPC.push_back(PC);
+        lines.addLine(instruction);
+        if (!instruction.empty())
+        {
+            pcToLine.push_back(lines.size() - 1);
+            PC += 4;
+        }
+    }
+    lineCounter = lines.size();
+    return true;
+}
 
-            std::cout << "Executed";
-            for (int i = 0; i < v.size(); i++)
-            {
-                std::cout << ' ' << v[i] << ((i == 0 || i == v.size() - 1) ? "" : ",");
-            }
-            std::cout << "; PC=0x" << std::hex << std::setw(8) << std::setfill('0') << PC << std::endl;
+long long simulator::loadExecutable()
+{
+    elf::image image;
+    std::string problem = elf::read(lines.text(), image);
+    if (problem.empty() && image.flags & elf::compressed)
+        problem = "Compressed instructions are not supported";
+    if (!problem.empty())
+    {
+        printError(problem);
+        return 0;
+    }
+    executable = true;
 
-            bool doJump = false;
-            std::map<std::string, std::pair<long long, long long>>::iterator index;
-            switch (riscInfo[v[0]].opcode)
-            {
-            // R Type Instructions
-            case 0b0110011:
-                switch (riscInfo[v[0]].func3)
-                {
-                case 0x0:
-                    if (riscInfo[v[0]].func7 == 0x0)
-                        registers[solveRegister(v[1])] = registers[solveRegister(v[2])] + registers[solveRegister(v[3])];
-                    else
-                        registers[solveRegister(v[1])] = registers[solveRegister(v[2])] - registers[solveRegister(v[3])];
-                    break;
-                case 0x1:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] << (registers[solveRegister(v[3])] % 64);
-                    break;
-                case 0x2:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] < registers[solveRegister(v[3])];
-                    break;
-                case 0x3:
-                    registers[solveRegister(v[1])] = (unsigned long long)registers[solveRegister(v[2])] < (unsigned long long)registers[solveRegister(v[3])];
-                    break;
-                case 0x4:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] ^ registers[solveRegister(v[3])];
-                    break;
-                case 0x5:
-                    if (riscInfo[v[0]].func7 == 0x0)
-                        registers[solveRegister(v[1])] = registers[solveRegister(v[2])] >> (registers[solveRegister(v[3])] % 64);
-                    else
-                    {
-                        if (registers[solveRegister(v[2])] >> 63 == 1)
-                            registers[solveRegister(v[1])] = (registers[solveRegister(v[2])] >> (registers[solveRegister(v[3])] % 64)) | (~0ULL << (64 - (registers[solveRegister(v[3])] % 64)));
-                        else
-                            registers[solveRegister(v[1])] = (registers[solveRegister(v[2])] >> (registers[solveRegister(v[3])] % 64));
-                    }
-                    break;
-                case 0x6:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] | registers[solveRegister(v[3])];
-                    break;
-                case 0x7:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] & registers[solveRegister(v[3])];
-                    break;
-                }
-                break;
-            // I type Instructions
-            case 0b0010011:
-                switch (riscInfo[v[0]].func3)
-                {
-                case 0x0:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] + solveImmediateSigned(v[3], 12);
-                    break;
-                case 0x1:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] << solveImmediateNonNegative(v[3], 6);
-                    break;
-                case 0x2:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] < solveImmediateSigned(v[3], 12);
-                    break;
-                case 0x3:
-                    registers[solveRegister(v[1])] = (unsigned long long)registers[solveRegister(v[2])] < solveImmediateSigned(v[3], 12);
-                    break;
-                case 0x4:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] ^ solveImmediateSigned(v[3], 12);
-                    break;
-                case 0x5:
-                    if (riscInfo[v[0]].func7 == 0x0)
-                        registers[solveRegister(v[1])] = registers[solveRegister(v[2])] >> solveImmediateNonNegative(v[3], 6);
-                    else
-                    {
-                        if (registers[solveRegister(v[2])] >> 63 == 1)
-                            registers[solveRegister(v[1])] = (registers[solveRegister(v[2])] >> solveImmediateNonNegative(v[3], 6)) | (-1LL << (64 - solveImmediateNonNegative(v[3], 6)));
-                        else
-                            registers[solveRegister(v[1])] = (registers[solveRegister(v[2])] >> solveImmediateNonNegative(v[3], 6));
-                    }
-                    break;
-                case 0x6:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] | solveImmediateSigned(v[3], 12);
-                    break;
-                case 0x7:
-                    registers[solveRegister(v[1])] = registers[solveRegister(v[2])] & solveImmediateSigned(v[3], 12);
-                    break;
-                }
-                break;
-            // Load Type Instructions
-            case 0b0000011:
-                if (v.size() == 3)
-                {
-                    int start = v[2].find('(');
-                    int end = v[2].find(')');
-                    if (riscInfo[v[0]].func3 == 0x0)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 8, true);
-                    else if (riscInfo[v[0]].func3 == 0x1)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 16, true);
-                    else if (riscInfo[v[0]].func3 == 0x2)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 32, true);
-                    else if (riscInfo[v[0]].func3 == 0x3)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 64, true);
-                    else if (riscInfo[v[0]].func3 == 0x4)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 8, false);
-                    else if (riscInfo[v[0]].func3 == 0x5)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 16, false);
-                    else if (riscInfo[v[0]].func3 == 0x6)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 32, false);
-                }
-                else if (v.size() == 4)
-                {
-                    if (riscInfo[v[0]].func3 == 0x0)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 8, true);
-                    else if (riscInfo[v[0]].func3 == 0x1)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 16, true);
-                    else if (riscInfo[v[0]].func3 == 0x2)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 32, true);
-                    else if (riscInfo[v[0]].func3 == 0x3)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 64, true);
-                    else if (riscInfo[v[0]].func3 == 0x4)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 8, false);
-                    else if (riscInfo[v[0]].func3 == 0x5)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 16, false);
-                    else if (riscInfo[v[0]].func3 == 0x6)
-                        registers[solveRegister(v[1])] = loadData(registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 32, false);
-                }
-                break;
-            // S type Instructions
-            case 0b0100011:
-                if (v.size() == 3)
-                {
-                    int start = v[2].find('(');
-                    int end = v[2].find(')');
-                    if (riscInfo[v[0]].func3 == 0x0)
-                        storeData(registers[solveRegister(v[1])], registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 8);
-                    else if (riscInfo[v[0]].func3 == 0x1)
-                        storeData(registers[solveRegister(v[1])], registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 16);
-                    else if (riscInfo[v[0]].func3 == 0x2)
-                        storeData(registers[solveRegister(v[1])], registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 32);
-                    else if (riscInfo[v[0]].func3 == 0x3)
-                        storeData(registers[solveRegister(v[1])], registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12), 64);
-                }
-                else if (v.size() == 4)
-                {
-                    if (riscInfo[v[0]].func3 == 0x0)
-                        storeData(registers[solveRegister(v[1])], registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 8);
-                    else if (riscInfo[v[0]].func3 == 0x1)
-                        storeData(registers[solveRegister(v[1])], registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 16);
-                    else if (riscInfo[v[0]].func3 == 0x2)
-                        storeData(registers[solveRegister(v[1])], registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 32);
-                    else if (riscInfo[v[0]].func3 == 0x3)
-                        storeData(registers[solveRegister(v[1])], registers[solveRegister(v[3])] + solveImmediateSigned(v[2], 12), 64);
-                }
-                break;
-            // B Type Instruction
-            case 0b1100011:
-                if (riscInfo[v[0]].func3 == 0x0)
-                {
-                    if (registers[solveRegister(v[1])] == registers[solveRegister(v[2])])
-                        doJump = true;
-                }
-                else if (riscInfo[v[0]].func3 == 0x1)
-                {
-                    if (registers[solveRegister(v[1])] != registers[solveRegister(v[2])])
-                        doJump = true;
-                }
-                else if (riscInfo[v[0]].func3 == 0x4)
-                {
-                    if (registers[solveRegister(v[1])] < registers[solveRegister(v[2])])
-                        doJump = true;
-                }
-                else if (riscInfo[v[0]].func3 == 0x5)
-                {
-                    if (registers[solveRegister(v[1])] >= registers[solveRegister(v[2])])
-                        doJump = true;
-                }
-                else if (riscInfo[v[0]].func3 == 0x6)
-                {
-                    if ((unsigned long long)registers[solveRegister(v[1])] < (unsigned long long)registers[solveRegister(v[2])])
-                        doJump = true;
-                }
-                else if (riscInfo[v[0]].func3 == 0x7)
-                {
-                    if ((unsigned long long)registers[solveRegister(v[1])] >= (unsigned long long)registers[solveRegister(v[2])])
-                        doJump = true;
-                }
-                if (doJump)
-                {
-                    index = Labels.find(v[3]);
-                    if (index != Labels.end())
-                    {
-                        lineCounter = index->second.second;
-                        PC = index->second.first;
-                    }
-                    else
-                    {
-                        PC += solveImmediateSigned(v[2], 21);
-                        if (PC % 2)
-                            PC--;
-                        lineCounter = findLineNumberWrtPC(PC);
-                    }
-                }
-                break;
-            // JAL Instruction
-            case 0b1101111:
-                registers[solveRegister(v[1])] = PC + 4;
-                index = Labels.find(v[2]);
-                if (index != Labels.end())
-                {
-                    PC = index->second.first;
-                    lineCounter = index->second.second;
-                }
-                else
-                {
-                    PC += solveImmediateSigned(v[2], 21);
-                    if (PC % 2)
-                        PC--;
-                    lineCounter = findLineNumberWrtPC(PC);
-                }
-                Stack.push_back({v[2], lineCounter - 1});
-                doJump = true;
-                break;
-            // JALR Instruction
-            case 0b1100111:
-                registers[solveRegister(v[1])] = PC + 4;
-                if (v.size() == 4)
-                    PC = registers[solveRegister(v[2])] + solveImmediateSigned(v[3], 12);
-                else if (v.size() == 3)
-                {
-                    int start = v[2].find('(');
-                    int end = v[2].find(')');
-                    PC = registers[solveRegister(v[2].substr(start + 1, end - start - 1))] + solveImmediateSigned(v[2].substr(0, start), 12);
-                }
-                lineCounter = findLineNumberWrtPC(PC);
-                Stack.pop_back();
-                doJump = true;
-                break;
-            // AUIPC Instruction
-            case 0b0010111:
-                registers[solveRegister(v[1])] = PC + (solveImmediateNonNegative(v[2], 20) << 12);
-                break;
-            // LUI Instruction
-            case 0b0110111:
-                long long value = solveImmediateNonNegative(v[2], 20);
-                if (value >> 19 == 1)
-                    value = value | (~0ULL << 20);
-                registers[solveRegister(v[1])] = value << 12;
-                break;
+    long long top = 0, codeEnd = 0;
+    for (auto &s : image.segments)
+    {
+        top = std::max(top, s.address + s.memorySize);
+        if (s.executable)
+            codeEnd = std::max(codeEnd, (s.address + s.memorySize + 3) & ~3LL);
+    }
+    if (codeEnd > maxExecutableText)
+    {
+        std::stringstream ss;
+        ss << "The text of the executable ends too high, at 0x" << std::hex << codeEnd;
+        printError(ss.str());
+        return 0;
+    }
+    if (image.entry < 0 || image.entry >= codeEnd || image.entry % 4)
+    {
+        printError("The entry point is outside the text");
+        return 0;
+    }
+
+    // Memory grows to hold every segment with room for a stack above them
+    long long needed = ((top + memory::pageSize - 1) & ~(memory::pageSize - 1)) + executableStack;
+    if (ram.size() < needed)
+        ram.setSize(needed);
+    for (auto &s : image.segments)
+        ram.write(s.address, (const u_int8_t *)s.data.data(), s.data.size());
+    // argc, argv and envp above the stack pointer read as zero
+    registers[2] = (ram.size() - 32) & ~15LL;
+
+    // The text has no source, so line n is simply the instruction at 4 * (n - 1)
+    for (long long address = 0; address < codeEnd; address += 4)
+    {
+        pcToLine.push_back(lines.size());
+        lineToPC.push_back(address);
+        lines.addLine(std::string_view());
+    }
+    for (auto &sym : image.symbols)
+    {
+        Labels.insert({std::string(sym.name), {sym.address, lineOfPC(sym.address)}});
+        if (sym.function)
+            symbols.insert({sym.address, sym.name});
+    }
+    auto entry = symbols.find(image.entry);
+    Stack[0] = {entry == symbols.end() ? std::string("_start") : std::string(entry->second), lineOfPC(image.entry)};
+    return image.entry;
+}
+
+void simulator::decodeProgram()
+{
+    program.clear();
+    for (long long address = 0; address < pcToLine.size() * 4; address += 4)
+        program.push_back(decoder::decode(loadData(address, 32, false), address));
+    textEnd = program.size() * 4;
+    breakCounts.assign(program.size(), 0);
+}
+
+u_int32_t simulator::fetchInstruction(long long PC)
+{
+    // Instruction fetch reads memory directly and is not counted as a D-cache access
+    return memory::loadLittle(ram.readable(PC), 4);
+}
+
+long long simulator::lineOfPC(long long PC)
+{
+    if (PC >= 0 && PC < pcToLine.size() * 4 && PC % 4 == 0)
+        return pcToLine[PC >> 2];
+    return 0;
+}
+
+bool simulator::isInText(long long PC)
+{
+    return PC >= 0 && PC < textEnd && PC % 4 == 0;
+}
+
+void simulator::invalidateCode(long long address, int size)
+{
+    // Instruction fetch sees memory, so re-decode the words the store touched and
+    // drop every translated block; run picks the change up before the next block
+    for (long long word = address & ~3LL; word < address + size / 8 && word < textEnd; word += 4)
+        program[word >> 2] = decoder::decode(fetchInstruction(word), word);
+    codeModified = interrupted = true;
+}
+
+simulator::block *simulator::findBlock(long long PC)
+{
+    block *&recent = recentBlocks[(PC >> 2) & (recentBlocks.size() - 1)];
+    if (recent && recent->start == PC)
+        return recent;
+    auto found = blocks.find(PC);
+    if (found != blocks.end())
+        return recent = &found->second;
+
+    block &b = blocks[PC];
+    recent = &b;
+    b.start = PC;
+    b.next = b.taken = nullptr;
+    b.executions = b.nativeOps = 0;
+    b.runs = b.nativeRuns = 0;
+    // Blocks also end in front of a breakpoint so that it is only checked on block entry
+    long long address = PC;
+    do
+    {
+        b.ops.push_back(decoder::decode(fetchInstruction(address), address));
+        b.handlers.push_back(handlerFor(b.ops.back()));
+        address += 4;
+    } while (!decoder::endsBlock(b.ops.back().op) && isInText(address) && !breakCounts[address >> 2]);
+    b.end = address;
+    return &b;
+}
+
+void simulator::countBlockRuns()
+{
+    for (auto &b : blocks)
+    {
+        for (int i = 0; i < b.second.ops.size(); i++)
+            opCounts[b.second.ops[i].op] += b.second.runs + (i < b.second.nativeOps ? b.second.nativeRuns : 0);
+        b.second.runs = b.second.nativeRuns = 0;
+    }
+}
+
+void simulator::clearBlocks()
+{
+    countBlockRuns();
+    blocks.clear();
+    recentBlocks.fill(nullptr);
+}
+
+void simulator::traceInstruction(long long PC)
+{
+    assembly::tokens v = lines[lineOfPC(PC)];
+    if (echo)
+    {
+        *out << "Executed";
+        if (v.empty())
+            *out << " 0x" << std::hex << std::setw(8) << std::setfill('0') << fetchInstruction(PC);
+        for (int i = 0; i < v.size(); i++)
+        {
+            *out << ' ' << v[i] << ((i == 0 || i == v.size() - 1) ? "" : ",");
+        }
+        *out << "; PC=0x" << std::hex << std::setw(8) << std::setfill('0') << PC << std::endl;
+    }
+
+    // The trace file gets the same text, collected in memory and written in large chunks
+    if (traceFile.is_open())
+    {
+        traceBuffer += "Executed";
+        if (v.empty())
+        {
+            traceBuffer += " 0x";
+            appendHex(traceBuffer, fetchInstruction(PC));
+        }
+        for (int i = 0; i < v.size(); i++)
+        {
+            traceBuffer += ' ';
+            traceBuffer += v[i];
+            if (i != 0 && i != v.size() - 1)
+                traceBuffer += ',';
+        }
+        traceBuffer += "; PC=0x";
+        appendHex(traceBuffer, PC);
+        traceBuffer += '\n';
+        if (traceBuffer.size() >= traceChunk)
+            flushTrace();
+    }
+
+    if (traceHandler)
+        traceHandler(PC, v);
+}
+
+void simulator::flushTrace()
+{
+    traceFile.write(traceBuffer.data(), traceBuffer.size());
+    traceBuffer.clear();
+}
+
+void simulator::updateStackTop(long long line, decoder::operation op)
+{
+    // The innermost frame records the last executed line, calls and returns
+    // already left the caller's line in place
+    if (line && op != decoder::JAL && op != decoder::JALR)
+        Stack[Stack.size() - 1].second = line;
+}
+
+void simulator::pushFrame(long long target)
+{
+    // A call is named by the function symbol at its target, or else by the address
+    auto symbol = symbols.find(target);
+    if (symbol != symbols.end())
+        Stack.push_back({std::string(symbol->second), lineOfPC(target)});
+    else
+    {
+        std::stringstream ss;
+        ss << "0x" << std::hex << target;
+        Stack.push_back({ss.str(), lineOfPC(target)});
+    }
+}
+
+void simulator::systemCall(long long &nextPC)
+{
+    // The Linux system calls a program without an operating system needs,
+    // numbered by a7 with arguments from a0
+    switch (registers[17])
+    {
+    case 64:
+    {
+        long long address = registers[11], count = registers[12];
+        if (registers[10] != 1 && registers[10] != 2)
+            registers[10] = -9;
+        else if (count < 0 || address < 0 || address > ram.size() - count)
+            registers[10] = -14;
+        else
+        {
+            std::string text(count, '\0');
+            ram.read(address, (u_int8_t *)text.data(), count);
+            (registers[10] == 1 ? *out : *err) << text << std::flush;
+            registers[10] = count;
+        }
+        break;
+    }
+    case 93:
+    case 94:
+        *out << "Program exited with code " << std::dec << registers[10] << std::endl;
+        // Leaving the text section ends the program
+        nextPC = textEnd;
+        break;
+    default:
+        registers[10] = -38;
+    }
+}
+
+void simulator::execute(const decoder::instruction &ins)
+{
+    long long nextPC = PC + 4;
+    switch (ins.op)
+    {
+    // R Type Instructions
+    case decoder::ADD:
+        registers[ins.rd] = registers[ins.rs1] + registers[ins.rs2];
+        break;
+    case decoder::SUB:
+        registers[ins.rd] = registers[ins.rs1] - registers[ins.rs2];
+        break;
+    case decoder::SLL:
+        registers[ins.rd] = registers[ins.rs1] << (registers[ins.rs2] & 0b111111);
+        break;
+    case decoder::SLT:
+        registers[ins.rd] = registers[ins.rs1] < registers[ins.rs2];
+        break;
+    case decoder::SLTU:
+        registers[ins.rd] = (unsigned long long)registers[ins.rs1] < (unsigned long long)registers[ins.rs2];
+        break;
+    case decoder::XOR:
+        registers[ins.rd] = registers[ins.rs1] ^ registers[ins.rs2];
+        break;
+    case decoder::SRL:
+        registers[ins.rd] = (unsigned long long)registers[ins.rs1] >> (registers[ins.rs2] & 0b111111);
+        break;
+    case decoder::SRA:
+        registers[ins.rd] = registers[ins.rs1] >> (registers[ins.rs2] & 0b111111);
+        break;
+    case decoder::OR:
+        registers[ins.rd] = registers[ins.rs1] | registers[ins.rs2];
+        break;
+    case decoder::AND:
+        registers[ins.rd] = registers[ins.rs1] & registers[ins.rs2];
+        break;
+
+    // I type Instructions
+    case decoder::ADDI:
+        registers[ins.rd] = registers[ins.rs1] + ins.imm;
+        break;
+    case decoder::SLTI:
+        registers[ins.rd] = registers[ins.rs1] < ins.imm;
+        break;
+    case decoder::SLTIU:
+        registers[ins.rd] = (unsigned long long)registers[ins.rs1] < (unsigned long long)ins.imm;
+        break;
+    case decoder::XORI:
+        registers[ins.rd] = registers[ins.rs1] ^ ins.imm;
+        break;
+    case decoder::ORI:
+        registers[ins.rd] = registers[ins.rs1] | ins.imm;
+        break;
+    case decoder::ANDI:
+        registers[ins.rd] = registers[ins.rs1] & ins.imm;
+        break;
+    case decoder::SLLI:
+        registers[ins.rd] = registers[ins.rs1] << ins.imm;
+        break;
+    case decoder::SRLI:
+        registers[ins.rd] = (unsigned long long)registers[ins.rs1] >> ins.imm;
+        break;
+    case decoder::SRAI:
+        registers[ins.rd] = registers[ins.rs1] >> ins.imm;
+        break;
+
+    // Word Instructions, which sign extend their 32 bit result
+    case decoder::ADDIW:
+        registers[ins.rd] = (int32_t)((u_int32_t)registers[ins.rs1] + (u_int32_t)ins.imm);
+        break;
+    case decoder::SLLIW:
+        registers[ins.rd] = (int32_t)((u_int32_t)registers[ins.rs1] << ins.imm);
+        break;
+    case decoder::SRLIW:
+        registers[ins.rd] = (int32_t)((u_int32_t)registers[ins.rs1] >> ins.imm);
+        break;
+    case decoder::SRAIW:
+        registers[ins.rd] = (int32_t)registers[ins.rs1] >> ins.imm;
+        break;
+    case decoder::ADDW:
+        registers[ins.rd] = (int32_t)((u_int32_t)registers[ins.rs1] + (u_int32_t)registers[ins.rs2]);
+        break;
+    case decoder::SUBW:
+        registers[ins.rd] = (int32_t)((u_int32_t)registers[ins.rs1] - (u_int32_t)registers[ins.rs2]);
+        break;
+    case decoder::SLLW:
+        registers[ins.rd] = (int32_t)((u_int32_t)registers[ins.rs1] << (registers[ins.rs2] & 0b11111));
+        break;
+    case decoder::SRLW:
+        registers[ins.rd] = (int32_t)((u_int32_t)registers[ins.rs1] >> (registers[ins.rs2] & 0b11111));
+        break;
+    case decoder::SRAW:
+        registers[ins.rd] = (int32_t)registers[ins.rs1] >> (registers[ins.rs2] & 0b11111);
+        break;
+
+    // Load Type Instructions
+    case decoder::LB:
+        registers[ins.rd] = loadData(registers[ins.rs1] + ins.imm, 8, true);
+        break;
+    case decoder::LH:
+        registers[ins.rd] = loadData(registers[ins.rs1] + ins.imm, 16, true);
+        break;
+    case decoder::LW:
+        registers[ins.rd] = loadData(registers[ins.rs1] + ins.imm, 32, true);
+        break;
+    case decoder::LD:
+        registers[ins.rd] = loadData(registers[ins.rs1] + ins.imm, 64, true);
+        break;
+    case decoder::LBU:
+        registers[ins.rd] = loadData(registers[ins.rs1] + ins.imm, 8, false);
+        break;
+    case decoder::LHU:
+        registers[ins.rd] = loadData(registers[ins.rs1] + ins.imm, 16, false);
+        break;
+    case decoder::LWU:
+        registers[ins.rd] = loadData(registers[ins.rs1] + ins.imm, 32, false);
+        break;
+
+    // S type Instructions
+    case decoder::SB:
+        storeData(registers[ins.rs2], registers[ins.rs1] + ins.imm, 8);
+        break;
+    case decoder::SH:
+        storeData(registers[ins.rs2], registers[ins.rs1] + ins.imm, 16);
+        break;
+    case decoder::SW:
+        storeData(registers[ins.rs2], registers[ins.rs1] + ins.imm, 32);
+        break;
+    case decoder::SD:
+        storeData(registers[ins.rs2], registers[ins.rs1] + ins.imm, 64);
+        break;
+
+    // B Type Instructions
+    case decoder::BEQ:
+        if (registers[ins.rs1] == registers[ins.rs2])
+        {
+            nextPC = ins.target;
+            branchesTaken++;
+        }
+        break;
+    case decoder::BNE:
+        if (registers[ins.rs1] != registers[ins.rs2])
+        {
+            nextPC = ins.target;
+            branchesTaken++;
+        }
+        break;
+    case decoder::BLT:
+        if (registers[ins.rs1] < registers[ins.rs2])
+        {
+            nextPC = ins.target;
+            branchesTaken++;
+        }
+        break;
+    case decoder::BGE:
+        if (registers[ins.rs1] >= registers[ins.rs2])
+        {
+            nextPC = ins.target;
+            branchesTaken++;
+        }
+        break;
+    case decoder::BLTU:
+        if ((unsigned long long)registers[ins.rs1] < (unsigned long long)registers[ins.rs2])
+        {
+            nextPC = ins.target;
+            branchesTaken++;
+        }
+        break;
+    case decoder::BGEU:
+        if ((unsigned long long)registers[ins.rs1] >= (unsigned long long)registers[ins.rs2])
+        {
+            nextPC = ins.target;
+            branchesTaken++;
+        }
+        break;
+
+    // JAL Instruction
+    case decoder::JAL:
+    {
+        long long line = lineOfPC(PC);
+        registers[ins.rd] = nextPC;
+        nextPC = ins.target;
+        Stack[Stack.size() - 1].second = line;
+        // Every jal of a source opens a frame, in an executable jal x0 is a
+        // plain jump
+        bool call = ins.rd || !executable;
+        if (call && !lines[line].empty())
+            Stack.push_back({std::string(lines[line][2]), lineOfPC(nextPC) - 1});
+        else if (call)
+            pushFrame(nextPC);
+        if (call && callGraph)
+            enterCall();
+        break;
+    }
+    // JALR Instruction
+    case decoder::JALR:
+    {
+        long long target = (registers[ins.rs1] + ins.imm) & ~1LL;
+        registers[ins.rd] = nextPC;
+        nextPC = target;
+        // Every jalr of a source returns, in an executable jalr with a link
+        // register is an indirect call
+        bool call = ins.rd && executable;
+        if (call)
+        {
+            Stack[Stack.size() - 1].second = lineOfPC(PC);
+            pushFrame(target);
+        }
+        else if (Stack.size() > 1)
+            Stack.pop_back();
+        if (callGraph && call)
+            enterCall();
+        else if (callGraph)
+            leaveCall();
+        break;
+    }
+    // AUIPC Instruction
+    case decoder::AUIPC:
+        registers[ins.rd] = PC + ins.imm;
+        break;
+    // LUI Instruction
+    case decoder::LUI:
+        registers[ins.rd] = ins.imm;
+        break;
+    case decoder::FENCE:
+        break;
+    case decoder::ECALL:
+        systemCall(nextPC);
+        break;
+    default:
+        printError("Illegal instruction");
+    }
+    PC = nextPC;
+    registers[0] = 0;
+}
+
+simulator::handler simulator::handlerFor(const decoder::instruction &ins)
+{
+    // An instruction that only writes rd does nothing when rd is x0
+    bool writesOnly = ins.op == decoder::LUI || ins.op == decoder::AUIPC || (ins.op >= decoder::ADDI && ins.op <= decoder::SRAW);
+    if (writesOnly && ins.rd == 0)
+        return [](simulator &sim, const decoder::instruction &) { sim.PC += 4; return true; };
+
+    switch (ins.op)
+    {
+    case decoder::ADD:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] + sim.registers[ins.rs2]; sim.PC += 4; return true; };
+    case decoder::SUB:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] - sim.registers[ins.rs2]; sim.PC += 4; return true; };
+    case decoder::SLL:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] << (sim.registers[ins.rs2] & 0b111111); sim.PC += 4; return true; };
+    case decoder::SLT:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] < sim.registers[ins.rs2]; sim.PC += 4; return true; };
+    case decoder::SLTU:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = (unsigned long long)sim.registers[ins.rs1] < (unsigned long long)sim.registers[ins.rs2]; sim.PC += 4; return true; };
+    case decoder::XOR:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] ^ sim.registers[ins.rs2]; sim.PC += 4; return true; };
+    case decoder::SRL:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = (unsigned long long)sim.registers[ins.rs1] >> (sim.registers[ins.rs2] & 0b111111); sim.PC += 4; return true; };
+    case decoder::SRA:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] >> (sim.registers[ins.rs2] & 0b111111); sim.PC += 4; return true; };
+    case decoder::OR:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] | sim.registers[ins.rs2]; sim.PC += 4; return true; };
+    case decoder::AND:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] & sim.registers[ins.rs2]; sim.PC += 4; return true; };
+
+    case decoder::ADDI:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] + ins.imm; sim.PC += 4; return true; };
+    case decoder::SLTI:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] < ins.imm; sim.PC += 4; return true; };
+    case decoder::SLTIU:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = (unsigned long long)sim.registers[ins.rs1] < (unsigned long long)ins.imm; sim.PC += 4; return true; };
+    case decoder::XORI:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] ^ ins.imm; sim.PC += 4; return true; };
+    case decoder::ORI:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] | ins.imm; sim.PC += 4; return true; };
+    case decoder::ANDI:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] & ins.imm; sim.PC += 4; return true; };
+    case decoder::SLLI:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] << ins.imm; sim.PC += 4; return true; };
+    case decoder::SRLI:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = (unsigned long long)sim.registers[ins.rs1] >> ins.imm; sim.PC += 4; return true; };
+    case decoder::SRAI:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.registers[ins.rs1] >> ins.imm; sim.PC += 4; return true; };
+    case decoder::LUI:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = ins.imm; sim.PC += 4; return true; };
+    case decoder::AUIPC:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.PC + ins.imm; sim.PC += 4; return true; };
+
+    // Loads and stores may stop the block, and a load into x0 still accesses memory
+    case decoder::LB:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.loadData(sim.registers[ins.rs1] + ins.imm, 8, true); sim.registers[0] = 0; sim.PC += 4; return !sim.interrupted; };
+    case decoder::LH:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.loadData(sim.registers[ins.rs1] + ins.imm, 16, true); sim.registers[0] = 0; sim.PC += 4; return !sim.interrupted; };
+    case decoder::LW:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.loadData(sim.registers[ins.rs1] + ins.imm, 32, true); sim.registers[0] = 0; sim.PC += 4; return !sim.interrupted; };
+    case decoder::LD:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.loadData(sim.registers[ins.rs1] + ins.imm, 64, true); sim.registers[0] = 0; sim.PC += 4; return !sim.interrupted; };
+    case decoder::LBU:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.loadData(sim.registers[ins.rs1] + ins.imm, 8, false); sim.registers[0] = 0; sim.PC += 4; return !sim.interrupted; };
+    case decoder::LHU:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.loadData(sim.registers[ins.rs1] + ins.imm, 16, false); sim.registers[0] = 0; sim.PC += 4; return !sim.interrupted; };
+    case decoder::LWU:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.registers[ins.rd] = sim.loadData(sim.registers[ins.rs1] + ins.imm, 32, false); sim.registers[0] = 0; sim.PC += 4; return !sim.interrupted; };
+    case decoder::SB:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.storeData(sim.registers[ins.rs2], sim.registers[ins.rs1] + ins.imm, 8); sim.PC += 4; return !sim.interrupted; };
+    case decoder::SH:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.storeData(sim.registers[ins.rs2], sim.registers[ins.rs1] + ins.imm, 16); sim.PC += 4; return !sim.interrupted; };
+    case decoder::SW:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.storeData(sim.registers[ins.rs2], sim.registers[ins.rs1] + ins.imm, 32); sim.PC += 4; return !sim.interrupted; };
+    case decoder::SD:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.storeData(sim.registers[ins.rs2], sim.registers[ins.rs1] + ins.imm, 64); sim.PC += 4; return !sim.interrupted; };
+
+    // A branch is the last instruction of its block
+    case decoder::BEQ:
+        return [](simulator &sim, const decoder::instruction &ins) {
+            if (sim.registers[ins.rs1] == sim.registers[ins.rs2])
+            {
+                sim.PC = ins.target;
+                sim.branchesTaken++;
+            }
+            else
+                sim.PC += 4;
+            return true;
+        };
+    case decoder::BNE:
+        return [](simulator &sim, const decoder::instruction &ins) {
+            if (sim.registers[ins.rs1] != sim.registers[ins.rs2])
+            {
+                sim.PC = ins.target;
+                sim.branchesTaken++;
+            }
+            else
+                sim.PC += 4;
+            return true;
+        };
+    case decoder::BLT:
+        return [](simulator &sim, const decoder::instruction &ins) {
+            if (sim.registers[ins.rs1] < sim.registers[ins.rs2])
+            {
+                sim.PC = ins.target;
+                sim.branchesTaken++;
+            }
+            else
+                sim.PC += 4;
+            return true;
+        };
+    case decoder::BGE:
+        return [](simulator &sim, const decoder::instruction &ins) {
+            if (sim.registers[ins.rs1] >= sim.registers[ins.rs2])
+            {
+                sim.PC = ins.target;
+                sim.branchesTaken++;
+            }
+            else
+                sim.PC += 4;
+            return true;
+        };
+    case decoder::BLTU:
+        return [](simulator &sim, const decoder::instruction &ins) {
+            if ((unsigned long long)sim.registers[ins.rs1] < (unsigned long long)sim.registers[ins.rs2])
+            {
+                sim.PC = ins.target;
+                sim.branchesTaken++;
             }
+            else
+                sim.PC += 4;
+            return true;
+        };
+    case decoder::BGEU:
+        return [](simulator &sim, const decoder::instruction &ins) {
+            if ((unsigned long long)sim.registers[ins.rs1] >= (unsigned long long)sim.registers[ins.rs2])
+            {
+                sim.PC = ins.target;
+                sim.branchesTaken++;
+            }
+            else
+                sim.PC += 4;
+            return true;
+        };
+
+    // Word operations, jumps, which keep the call Stack, system calls and
+    // anything else go through execute
+    default:
+        return [](simulator &sim, const decoder::instruction &ins) { sim.execute(ins); return !sim.interrupted; };
+    }
+}
+
+void simulator::interpret(bool step, long long budget)
+{
+    long long lastPC = -1;
+    decoder::operation lastOp = decoder::INVALID;
+    while (budget > 0)
+    {
+        // Binary mode fetches and decodes the word in memory every time, so
+        // stores into the text section are seen by the next fetch
+        decoder::instruction fetched;
+        if (mode == BINARY)
+            fetched = decoder::decode(fetchInstruction(PC), PC);
+        const decoder::instruction &ins = mode == BINARY ? fetched : program[PC >> 2];
+
+        if (!step && breakpointCount && breakCounts[PC >> 2])
+        {
+            *out << "Execution stopped at breakpoint" << std::endl;
+            break;
+        }
 
-            if (!doJump)
+        lastPC = PC;
+        lastOp = ins.op;
+        if (tracing)
+            traceInstruction(PC);
+        if (profiling)
+            profileCounts[PC >> 2]++;
+        opCounts[ins.op]++;
+        execute(ins);
+        interpretedInstructions++;
+        budget--;
+        // Control leaving the text section ends the program
+        if (!isInText(PC) || (watchHit && stopAtWatchpoint()))
+            break;
+    }
+
+    updateStackTop(lineOfPC(lastPC), lastOp);
+}
+
+void simulator::runBlocks(long long budget)
+{
+    long long lastPC = -1;
+    decoder::operation lastOp = decoder::INVALID;
+    if (codeModified)
+    {
+        clearBlocks();
+        codeModified = interrupted = false;
+    }
+
+    block *current = findBlock(PC);
+    while (budget > 0)
+    {
+        if (breakpointCount && breakCounts[PC >> 2])
+        {
+            *out << "Execution stopped at breakpoint" << std::endl;
+            break;
+        }
+
+        // A block that does not fit in the remaining budget is interpreted up to the limit
+        bool whole = current->ops.size() <= budget;
+        if (mode == JIT && whole && current->executions < jitThreshold && ++current->executions == jitThreshold)
+            current->nativeOps = jit::compile(current->ops, PC, textEnd, !cacheEnabled && watchpoints.empty(), current->native);
+
+        // Native code may stop early, the interpreter carries on from there
+        int executed = 0;
+        if (mode == JIT && current->nativeOps && whole)
+        {
+            long long start = PC;
+            executed = current->native.entry(registers, ram.recentEntries(), &PC);
+            jitInstructions += executed;
+            if (tracing)
+                for (int i = 0; i < executed; i++)
+                    traceInstruction(start + 4 * i);
+            if (profiling)
+                for (int i = 0; i < executed; i++)
+                    profileCounts[(start >> 2) + i]++;
+            if (executed == current->nativeOps)
+                current->nativeRuns++;
+            else
+                for (int i = 0; i < executed; i++)
+                    opCounts[current->ops[i].op]++;
+            // Only a branch that ends the block is compiled
+            if (executed == current->ops.size() && current->ops.back().op >= decoder::BEQ && current->ops.back().op <= decoder::BGEU && PC == current->ops.back().target)
+                branchesTaken++;
+            if (executed)
+            {
+                lastPC = start + 4 * (executed - 1);
+                lastOp = current->ops[executed - 1].op;
+            }
+        }
+
+        int first = executed, last = whole ? current->ops.size() : budget;
+        // Calls in the call graph are charged with the instructions retired
+        // so far, which the handlers only count at the end of the block
+        if (tracing || profiling || callGraph)
+            while (executed < last)
+            {
+                const decoder::instruction &ins = current->ops[executed++];
+                lastPC = PC;
+                lastOp = ins.op;
+                if (tracing)
+                    traceInstruction(PC);
+                if (profiling)
+                    profileCounts[PC >> 2]++;
+                opCounts[ins.op]++;
+                execute(ins);
+                interpretedInstructions++;
+                // A store into the text section may have rewritten this very block
+                if (interrupted)
+                    break;
+            }
+        else if (executed < last)
+        {
+            // Nothing is watched per instruction, so the handlers run back to
+            // back and the block is counted once at its end
+            const handler *handlers = current->handlers.data();
+            const decoder::instruction *ops = current->ops.data();
+            while (executed < last)
             {
-                PC += 4;
-                lineCounter++;
+                bool carryOn = handlers[executed](*this, ops[executed]);
+                executed++;
+                if (!carryOn)
+                    break;
             }
-            registers[0] = 0;
-        } while (!step && lineCounter < lines.size());
+            interpretedInstructions += executed - first;
+            if (first == 0 && executed == current->ops.size())
+                current->runs++;
+            else
+                for (int i = first; i < executed; i++)
+                    opCounts[ops[i].op]++;
+            lastPC = current->start + 4 * (executed - 1);
+            lastOp = ops[executed - 1].op;
+        }
+        budget -= executed;
+
+        if ((watchHit && stopAtWatchpoint()) || !isInText(PC) || budget == 0)
+            break;
 
+        if (codeModified)
+        {
+            clearBlocks();
+            codeModified = interrupted = false;
+            current = findBlock(PC);
+        }
+        else if (PC == current->end)
+            current = current->next ? current->next : (current->next = findBlock(PC));
+        else if (lastOp != decoder::JALR && PC == current->ops.back().target)
+            current = current->taken ? current->taken : (current->taken = findBlock(PC));
+        else
+            current = findBlock(PC);
+    }
+
+    updateStackTop(lineOfPC(lastPC), lastOp);
+}
+
+void simulator::run(bool step, bool quiet, long long count)
+{
+    if (error)
+    {
+        *out << "File not loaded as there is some error in the file" << std::endl;
+        return;
+    }
+
+    // step always echoes, run echoes unless it is quiet or tracing to a file
+    echo = step || (!quiet && !traceFile.is_open());
+    tracing = echo || traceFile.is_open() || traceHandler;
+    running = true;
+
+    // A negative count runs to the end; the global limit caps everything retired since load
+    long long budget = step ? 1 : (count < 0 ? LLONG_MAX : count);
+    bool limited = false;
+    if (instructionLimit && instructionLimit - retired() < budget)
+    {
+        budget = std::max(0LL, instructionLimit - retired());
+        limited = true;
+    }
+
+    long long before = retired();
+    auto start = std::chrono::steady_clock::now();
+    if (lineCounter >= lines.size())
+        if (step)
+            *out << "Nothing to step" << std::endl;
+        else
+            *out << "Nothing to run" << std::endl;
+    else if ((mode == BLOCK || mode == JIT) && !step)
+        runBlocks(budget);
+    else
+        interpret(step, budget);
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    runSeconds += seconds.count();
+
+    running = false;
+    // Control leaving the text section ends the program
+    lineCounter = isInText(PC) ? lineOfPC(PC) : lines.size();
+    if (traceFile.is_open())
+        flushTrace();
+
+    if (limited && retired() >= instructionLimit && lineCounter < lines.size())
+        *out << "Instruction limit of " << std::dec << instructionLimit << " reached" << std::endl;
+
+    if (!step)
+    {
+        std::ostringstream report;
+        report << "Retired " << retired() - before << " instructions in " << std::setprecision(3) << seconds.count() << " s";
+        if (seconds.count() > 0)
+            report << " (" << (retired() - before) / seconds.count() / 1e6 << " MIPS)";
+        *out << report.str() << std::endl;
+    }
+
+    if (cacheSim)
+        cacheSim->flushLog();
     if (!step && cacheEnabled)
-        cacheSim->printStats();
+        cacheSim->printStats(*out);
+}
+
+long long simulator::retired()
+{
+    return jitInstructions + interpretedInstructions;
 }
 
 void simulator::load(std::string fileName)
 {
     this->fileName = fileName;
-    // Clearing out the cache output file
-    std::ofstream file(fileName.substr(0, fileName.find('.')) + ".output");
+    if (!outputNamed)
+        outputName = fileName.substr(0, fileName.find('.')) + ".output";
+    auto start = std::chrono::steady_clock::now();
+    assemble();
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    assembleSeconds = seconds.count();
+}
+
+void simulator::reload()
+{
+    std::set<long long> breaks = breakPoints;
+    std::vector<watchpoint> watches = watchpoints;
+    std::unordered_set<long long> watched = watchedPages;
+    std::vector<u_int64_t> oldHashes = lineHashes;
+    auto start = std::chrono::steady_clock::now();
+    if (!assembleChanges())
+        assemble();
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    assembleSeconds = seconds.count();
+
+    // Breakpoints behind the edit move with their lines
+    long long prefix, suffix;
+    unchangedLines(oldHashes, lineHashes, prefix, suffix);
+    long long oldCount = oldHashes.size() - 1, newCount = lineHashes.size() - 1;
+    for (long long line : breaks)
+    {
+        if (line > oldCount - suffix && line <= oldCount)
+            line += newCount - oldCount;
+        if (breakPoints.insert(line).second && line < lineToPC.size() && lineToPC[line] < textEnd)
+        {
+            breakCounts[lineToPC[line] >> 2]++;
+            breakpointCount++;
+        }
+    }
+    for (const watchpoint &w : watches)
+        if (w.address + w.length <= ram.size())
+            watchpoints.push_back(w);
+    watchedPages = watched;
+    *out << "Reloaded " << fileName << std::endl;
+}
+
+bool simulator::beginLoad()
+{
+    // Clearing out the cache output file, after what the cache still holds
+    // of its log is written
+    if (cacheSim)
+        cacheSim->flushLog();
+    std::ofstream file(outputName);
     file.close();
 
-    bool dummy = cacheEnabled;
+    // Loading stores straight into memory, past the cache
+    bool cache = cacheEnabled;
     cacheEnabled = false;
     reset();
-    storeInstructions(fileName);
-    cacheEnabled = dummy;
-    PC = 0;
-    lineCounter = 1;
+    return cache;
+}
+
+void simulator::finishLoad(bool cache, long long entry)
+{
+    if (!error)
+        decodeProgram();
+    cacheEnabled = cache;
+    PC = entry;
+    lineCounter = program.empty() ? lines.size() : lineOfPC(PC);
+    // Counts of the last program say nothing about this one
+    profileCounts.assign(profiling ? program.size() : 0, 0);
+    profileMisses.assign(profiling ? program.size() : 0, 0);
+    if (callGraph)
+        setCallGraph(true);
+
+    // reload starts from the text and data as assembled, which only works
+    // while they are apart
+    reloadable = !error && lineHashes.size() == lines.size() && !(MC > dataStart && textEnd > dataStart);
+    if (reloadable)
+    {
+        assembledText.resize(textEnd);
+        ram.read(0, assembledText.data(), textEnd);
+        assembledData.resize(MC - dataStart);
+        ram.read(dataStart, assembledData.data(), MC - dataStart);
+    }
+}
+
+void simulator::assemble()
+{
+    bool cache = beginLoad();
+    long long entry = 0;
+    if (lines.map(fileName) && elf::isElf(lines.text()))
+        entry = loadExecutable();
+    else if (!lines.text().empty())
+    {
+        // An object file from an earlier load of the same source skips assembling
+        std::string objectName = withExtension(fileName, ".obj");
+        u_int64_t hash = lines.hash();
+        if (!loadObject(objectName, hash))
+        {
+            storeInstructions();
+            if (!error)
+                saveObject(objectName, hash);
+        }
+    }
+    finishLoad(cache, entry);
+}
+
+void simulator::setOutput(std::ostream &out, std::ostream &err)
+{
+    this->out = &out;
+    this->err = &err;
+}
+
+void simulator::setOutputName(std::string name)
+{
+    outputName = name;
+    outputNamed = true;
+}
+
+void simulator::discardOutput()
+{
+    out = err = &discard;
+}
+
+void simulator::setTraceCallback(traceCallback callback)
+{
+    traceHandler = callback;
+}
+
+std::array<long long, 32> simulator::getRegisters()
+{
+    std::array<long long, 32> values;
+    std::copy(registers, registers + 32, values.begin());
+    return values;
+}
+
+long long simulator::getPC()
+{
+    return PC;
+}
+
+long long simulator::getRetired()
+{
+    return retired();
+}
+
+bool simulator::isFinished()
+{
+    return lineCounter >= lines.size();
+}
+
+const std::vector<std::string> &simulator::getErrors()
+{
+    return errors;
+}
+
+std::vector<std::pair<std::string, int>> simulator::getStack()
+{
+    if (isFinished())
+        return {};
+    return Stack;
+}
+
+u_int8_t simulator::getMemory(long long address)
+{
+    return ram.contains(address, 1) ? ram.readByte(address) : 0;
+}
+
+bool simulator::getCacheStatistics(cacheStatistics &stats)
+{
+    if (!cacheEnabled)
+        return false;
+    cacheSim->statistics(stats);
+    return true;
+}
+
+simulator::counterList simulator::getCounters()
+{
+    countBlockRuns();
+    auto sum = [&](decoder::operation first, decoder::operation last) {
+        long long total = 0;
+        for (int op = first; op <= last; op++)
+            total += opCounts[op];
+        return total;
+    };
+    long long branches = sum(decoder::BEQ, decoder::BGEU);
+    counterList counters{
+        {"instructions.retired", retired()},
+        {"instructions.alu", sum(decoder::LUI, decoder::AUIPC) + sum(decoder::ADDI, decoder::SRAW)},
+        {"instructions.load", sum(decoder::LB, decoder::LWU)},
+        {"instructions.store", sum(decoder::SB, decoder::SD)},
+        {"instructions.branch_taken", branchesTaken},
+        {"instructions.branch_not_taken", branches - branchesTaken},
+        {"instructions.jal", opCounts[decoder::JAL]},
+        {"instructions.jalr", opCounts[decoder::JALR]},
+        {"instructions.system", sum(decoder::FENCE, decoder::ECALL)},
+        {"instructions.jit", jitInstructions},
+        {"instructions.interpreted", interpretedInstructions},
+    };
+    cacheStatistics stats;
+    if (getCacheStatistics(stats))
+        counters.insert(counters.end(), {
+            {"cache.reads", stats.reads},
+            {"cache.writes", stats.writes},
+            {"cache.accesses", stats.accesses},
+            {"cache.hits", stats.hits},
+            {"cache.misses", stats.misses},
+            {"cache.evictions", stats.evictions},
+            {"cache.writebacks", stats.writebacks},
+        });
+    counters.insert(counters.end(), {
+        {"time.assemble", assembleSeconds},
+        {"time.run", runSeconds},
+        {"mips", runSeconds > 0 ? retired() / runSeconds / 1e6 : 0},
+    });
+    return counters;
+}
+
+void simulator::printCounters()
+{
+    // Counts print whole, times and rates with six digits
+    std::ostringstream report;
+    report << std::setprecision(6);
+    auto number = [&](double value) {
+        if (value == (long long)value)
+            report << (long long)value;
+        else
+            report << value;
+    };
+    counterList counters = getCounters();
+    if (json)
+    {
+        report << "{\"stats\":{";
+        for (size_t i = 0; i < counters.size(); i++)
+        {
+            report << (i ? "," : "") << '"' << counters[i].first << "\":";
+            number(counters[i].second);
+        }
+        report << "}}" << std::endl;
+    }
+    else
+    {
+        report << "Statistics:" << std::endl;
+        for (auto &c : counters)
+        {
+            report << c.first << " = ";
+            number(c.second);
+            report << std::endl;
+        }
+    }
+    *out << report.str();
+}
+
+void simulator::setCounterDump(std::string fileName)
+{
+    counterDumpName = fileName;
+}
+
+void simulator::setExecutionMode(executionMode mode)
+{
+    if (mode == JIT && !jit::available())
+    {
+        *out << "JIT is only available on x86-64 Linux, using block mode" << std::endl;
+        mode = BLOCK;
+    }
+    this->mode = mode;
+}
+
+void simulator::setInstructionLimit(long long limit)
+{
+    instructionLimit = limit;
+}
+
+void simulator::startTrace(std::string fileName)
+{
+    stopTrace();
+    traceFile.open(fileName);
+    if (!traceFile.is_open())
+        *out << "Could not open trace file " << fileName << std::endl;
+    else
+        traceBuffer.reserve(traceChunk);
+}
+
+void simulator::stopTrace()
+{
+    if (traceFile.is_open())
+    {
+        flushTrace();
+        traceFile.close();
+    }
+}
+
+void simulator::setJitThreshold(int threshold)
+{
+    jitThreshold = threshold;
+    // Blocks past the old threshold would never be looked at again
+    clearBlocks();
+}
+
+void simulator::printJitStats()
+{
+    int compiled = 0;
+    for (auto &b : blocks)
+        if (b.second.nativeOps)
+            compiled++;
+    *out << std::dec << "JIT statistics: Threshold=" << jitThreshold << ", Compiled blocks=" << compiled << ", JIT instructions=" << jitInstructions << ", Interpreted instructions=" << interpretedInstructions << std::endl;
+}
+
+void simulator::setJsonOutput(bool json)
+{
+    this->json = json;
+}
+
+long long simulator::cacheMisses()
+{
+    cacheStatistics stats;
+    cacheSim->statistics(stats);
+    return stats.misses;
+}
+
+void simulator::setProfiling(bool on)
+{
+    if (on)
+    {
+        profileCounts.assign(program.size(), 0);
+        profileMisses.assign(program.size(), 0);
+    }
+    profiling = on;
+}
+
+void simulator::printProfile(std::string listingName)
+{
+    long long total = 0, misses = 0;
+    for (size_t i = 0; i < profileCounts.size(); i++)
+    {
+        total += profileCounts[i];
+        misses += profileMisses[i];
+    }
+    if (!total)
+    {
+        if (json)
+            *out << "{\"profile\":null}" << std::endl;
+        else
+            *out << "Nothing profiled: use profile on before run" << std::endl;
+        return;
+    }
+
+    // Every instruction counts towards the closest label at or before it,
+    // the first label in name order where several share an address
+    std::map<long long, std::string_view> starts;
+    for (auto &label : Labels)
+        if (label.second.first < textEnd)
+            starts.emplace(label.second.first, label.first);
+    struct entry
+    {
+        std::string_view label;
+        long long count;
+        long long misses;
+    };
+    std::vector<entry> labels{{"(no label)", 0, 0}};
+    auto next = starts.begin();
+    for (size_t i = 0; i < profileCounts.size(); i++)
+    {
+        while (next != starts.end() && next->first <= (long long)i * 4)
+            labels.push_back({(next++)->second, 0, 0});
+        labels.back().count += profileCounts[i];
+        labels.back().misses += profileMisses[i];
+    }
+    labels.erase(std::remove_if(labels.begin(), labels.end(), [](const entry &e) { return !e.count; }), labels.end());
+    std::stable_sort(labels.begin(), labels.end(), [](const entry &a, const entry &b) { return a.count > b.count; });
+
+    std::vector<long long> hottest;
+    for (size_t i = 0; i < profileCounts.size(); i++)
+        if (profileCounts[i])
+            hottest.push_back(i);
+    size_t shown = std::min(hottest.size(), profileHottest);
+    std::partial_sort(hottest.begin(), hottest.begin() + shown, hottest.end(), [&](long long a, long long b) {
+        return profileCounts[a] != profileCounts[b] ? profileCounts[a] > profileCounts[b] : a < b;
+    });
+    hottest.resize(shown);
+
+    // The listing has every line of the source, or the text of an executable
+    if (listingName.empty())
+        listingName = withExtension(fileName, ".prof");
+    std::ofstream listing(listingName);
+    bool executable = elf::isElf(lines.text());
+    std::string_view source = lines.text();
+    listing << std::setw(12) << "Executions" << std::setw(10) << "Misses" << " | " << (executable ? "Instruction" : "Source") << '\n';
+    for (long long line = 1; line < lines.size(); line++)
+    {
+        std::string_view text;
+        if (!executable)
+        {
+            size_t end = source.find('\n');
+            text = source.substr(0, end);
+            source.remove_prefix(end == std::string_view::npos ? source.size() : end + 1);
+        }
+        long long address = line < lineToPC.size() ? lineToPC[line] : textEnd;
+        // The zero words around the segments of an executable are left out
+        if (executable)
+        {
+            if (!profileCounts[address >> 2] && !fetchInstruction(address))
+                continue;
+            auto label = starts.find(address);
+            if (label != starts.end())
+                listing << std::setw(22) << "" << " | " << label->second << ":\n";
+        }
+        if (address < textEnd && pcToLine[address >> 2] == line)
+            listing << std::dec << std::setw(12) << profileCounts[address >> 2] << std::setw(10) << profileMisses[address >> 2];
+        else
+            listing << std::setw(22) << "";
+        listing << " | ";
+        if (executable)
+            listing << "0x" << std::hex << std::setw(8) << std::setfill('0') << address << ": 0x" << std::setw(8) << fetchInstruction(address) << std::setfill(' ');
+        else
+            listing << text;
+        listing << '\n';
+    }
+    listing.close();
+
+    if (json)
+    {
+        *out << std::dec << "{\"profile\":{\"instructions\":" << total << ",\"misses\":" << misses << ",\"labels\":[";
+        for (size_t i = 0; i < labels.size(); i++)
+            *out << (i ? "," : "") << "{\"label\":\"" << labels[i].label << "\",\"count\":" << labels[i].count << ",\"misses\":" << labels[i].misses << '}';
+        *out << "],\"hottest\":[";
+        for (size_t i = 0; i < hottest.size(); i++)
+            *out << (i ? "," : "") << "{\"pc\":" << hottest[i] * 4 << ",\"line\":" << pcToLine[hottest[i]] << ",\"count\":" << profileCounts[hottest[i]] << ",\"misses\":" << profileMisses[hottest[i]] << '}';
+        *out << "],\"listing\":\"" << listingName << "\"}}" << std::endl;
+        return;
+    }
+
+    // Formatted apart so that the widths and precision stay off out
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2);
+    report << std::dec << "Profile of " << total << " instructions and " << misses << " D-cache misses" << std::endl;
+    report << std::left << std::setw(24) << "Label" << std::right << std::setw(14) << "Instructions" << std::setw(9) << "%" << std::setw(10) << "Misses" << std::endl;
+    for (auto &e : labels)
+        report << std::left << std::setw(24) << e.label << std::right << std::setw(14) << e.count << std::setw(9) << 100.0 * e.count / total << std::setw(10) << e.misses << std::endl;
+    report << "Hottest instructions:" << std::endl;
+    report << std::left << std::setw(12) << "PC" << std::right << std::setw(8) << "Line" << std::setw(14) << "Instructions" << std::setw(9) << "%" << std::setw(10) << "Misses" << "  Instruction" << std::endl;
+    for (long long i : hottest)
+    {
+        report << "0x" << std::hex << std::setw(8) << std::setfill('0') << i * 4 << std::setfill(' ') << std::dec << "  " << std::setw(8) << pcToLine[i] << std::setw(14) << profileCounts[i] << std::setw(9) << 100.0 * profileCounts[i] / total << std::setw(10) << profileMisses[i] << ' ';
+        assembly::tokens v = lines[pcToLine[i]];
+        if (v.empty())
+            report << " 0x" << std::hex << std::setw(8) << std::setfill('0') << fetchInstruction(i * 4) << std::setfill(' ') << std::dec;
+        for (int k = 0; k < v.size(); k++)
+            report << ' ' << v[k] << ((k == 0 || k == v.size() - 1) ? "" : ",");
+        report << std::endl;
+    }
+    *out << report.str();
+    if (!listing)
+        *out << "Could not write the listing to " << listingName << std::endl;
+    else
+        *out << "Annotated listing written to " << listingName << std::endl;
+}
+
+int simulator::callChild(int parent, const std::string &name)
+{
+    auto found = callNodes[parent].children.find(name);
+    if (found != callNodes[parent].children.end())
+        return found->second;
+    int node = callNodes.size();
+    callNodes[parent].children.emplace(name, node);
+    callNodes.push_back({name, parent, 0, 0, 0, {}});
+    return node;
+}
+
+void simulator::chargeCall(long long retiredNow)
+{
+    long long misses = cacheEnabled ? cacheMisses() : 0;
+    callNode &frame = callNodes[callPath.back()];
+    frame.instructions += retiredNow - callRetired;
+    frame.misses += misses - callMisses;
+    callRetired = retiredNow;
+    callMisses = misses;
+}
+
+void simulator::followStack()
+{
+    callPath.resize(1);
+    for (size_t i = 1; i < Stack.size(); i++)
+        callPath.push_back(callChild(callPath.back(), Stack[i].first));
+}
+
+void simulator::enterCall()
+{
+    // The jal or jalr making the call still belongs to the caller
+    chargeCall(retired() + 1);
+    int node = callChild(callPath.back(), Stack.back().first);
+    callNodes[node].calls++;
+    callPath.push_back(node);
+}
+
+void simulator::leaveCall()
+{
+    chargeCall(retired() + 1);
+    if (callPath.size() > Stack.size())
+        callPath.pop_back();
+}
+
+void simulator::setCallGraph(bool on)
+{
+    // Before the first load there is no Stack, finishLoad starts the graph
+    if (on && !Stack.empty())
+    {
+        callNodes.assign(1, {Stack[0].first, -1, 1, 0, 0, {}});
+        callPath.assign(1, 0);
+        followStack();
+        callRetired = retired();
+        callMisses = cacheEnabled ? cacheMisses() : 0;
+    }
+    else if (callGraph)
+        chargeCall(retired());
+    callGraph = on;
+}
+
+void simulator::printCallGraph(std::string foldedName)
+{
+    if (callGraph)
+        chargeCall(retired());
+    long long total = 0, misses = 0;
+    for (auto &node : callNodes)
+    {
+        total += node.instructions;
+        misses += node.misses;
+    }
+    if (!total)
+    {
+        if (json)
+            *out << "{\"callgraph\":null}" << std::endl;
+        else
+            *out << "Nothing profiled: use callgraph on before run" << std::endl;
+        return;
+    }
+
+    // A child always comes after its parent, so one pass from the back adds
+    // every node into its parent
+    std::vector<long long> instructions(callNodes.size()), nodeMisses(callNodes.size());
+    for (int i = callNodes.size() - 1; i >= 0; i--)
+    {
+        instructions[i] += callNodes[i].instructions;
+        nodeMisses[i] += callNodes[i].misses;
+        if (callNodes[i].parent >= 0)
+        {
+            instructions[callNodes[i].parent] += instructions[i];
+            nodeMisses[callNodes[i].parent] += nodeMisses[i];
+        }
+    }
+
+    // A recursive function only counts the outermost of its active calls
+    // as inclusive, so the depth of every name along the walk is kept
+    struct function
+    {
+        std::string_view name;
+        long long calls;
+        long long inclusive;
+        long long exclusive;
+        long long inclusiveMisses;
+        long long exclusiveMisses;
+    };
+    std::vector<function> functions;
+    std::unordered_map<std::string_view, size_t> functionIndex;
+    std::unordered_map<std::string_view, int> active;
+    std::vector<std::vector<int>> children(callNodes.size());
+    for (size_t i = 1; i < callNodes.size(); i++)
+        children[callNodes[i].parent].push_back(i);
+    // Nodes are pushed as they are entered and again, negated minus one, to leave them
+    std::vector<int> walk{0};
+    if (foldedName.empty())
+        foldedName = withExtension(fileName, ".folded");
+    std::ofstream folded(foldedName);
+    std::string path;
+    std::vector<size_t> pathLengths;
+    while (!walk.empty())
+    {
+        int node = walk.back();
+        walk.pop_back();
+        if (node < 0)
+        {
+            active[callNodes[-node - 1].name]--;
+            path.resize(pathLengths.back());
+            pathLengths.pop_back();
+            continue;
+        }
+        callNode &n = callNodes[node];
+        auto entry = functionIndex.emplace(n.name, functions.size());
+        if (entry.second)
+            functions.push_back({n.name, 0, 0, 0, 0, 0});
+        function &f = functions[entry.first->second];
+        f.calls += n.calls;
+        f.exclusive += n.instructions;
+        f.exclusiveMisses += n.misses;
+        if (!active[n.name]++)
+        {
+            f.inclusive += instructions[node];
+            f.inclusiveMisses += nodeMisses[node];
+        }
+
+        pathLengths.push_back(path.size());
+        if (!path.empty())
+            path += ';';
+        path += n.name;
+        if (n.instructions)
+            folded << path << ' ' << n.instructions << '\n';
+        walk.push_back(-node - 1);
+        walk.insert(walk.end(), children[node].rbegin(), children[node].rend());
+    }
+    folded.close();
+    std::stable_sort(functions.begin(), functions.end(), [](const function &a, const function &b) { return a.inclusive > b.inclusive; });
+
+    if (json)
+    {
+        *out << std::dec << "{\"callgraph\":{\"instructions\":" << total << ",\"misses\":" << misses << ",\"functions\":[";
+        for (size_t i = 0; i < functions.size(); i++)
+            *out << (i ? "," : "") << "{\"name\":\"" << functions[i].name << "\",\"calls\":" << functions[i].calls << ",\"inclusive\":" << functions[i].inclusive << ",\"exclusive\":" << functions[i].exclusive
+                 << ",\"inclusiveMisses\":" << functions[i].inclusiveMisses << ",\"exclusiveMisses\":" << functions[i].exclusiveMisses << '}';
+        *out << "],\"folded\":\"" << foldedName << "\"}}" << std::endl;
+        return;
+    }
+
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2);
+    report << "Call graph of " << total << " instructions and " << misses << " D-cache misses" << std::endl;
+    report << std::left << std::setw(24) << "Function" << std::right << std::setw(10) << "Calls" << std::setw(14) << "Inclusive" << std::setw(9) << "%" << std::setw(14) << "Exclusive" << std::setw(9) << "%"
+           << std::setw(12) << "Misses" << std::setw(12) << "Own misses" << std::endl;
+    for (auto &f : functions)
+        report << std::left << std::setw(24) << f.name << std::right << std::setw(10) << f.calls << std::setw(14) << f.inclusive << std::setw(9) << 100.0 * f.inclusive / total << std::setw(14) << f.exclusive << std::setw(9) << 100.0 * f.exclusive / total
+               << std::setw(12) << f.inclusiveMisses << std::setw(12) << f.exclusiveMisses << std::endl;
+    *out << report.str();
+    if (!folded)
+        *out << "Could not write the call stacks to " << foldedName << std::endl;
+    else
+        *out << "Collapsed call stacks written to " << foldedName << std::endl;
 }
 
 void simulator::printRegisters()
 {
-    std::cout << "Registers:" << std::endl;
+    if (json)
+    {
+        *out << "{\"regs\":[";
+        for (int i = 0; i < 32; i++)
+            *out << (i ? "," : "") << "\"0x" << std::hex << registers[i] << '"';
+        *out << "]}" << std::endl;
+        return;
+    }
+    *out << "Registers:" << std::endl;
     for (int i = 0; i < 32; i++)
-        std::cout << "x" << std::dec << i << (i < 10 ? " " : "") << " = 0x" << std::hex << registers[i] << std::endl;
+        *out << "x" << std::dec << i << (i < 10 ? " " : "") << " = 0x" << std::hex << registers[i] << std::endl;
 }
 
 void simulator::printMemory(std::string index, std::string count)
 {
     int i = solveImmediateNonNegative(index, 20);
     int c = solveImmediateNonNegative(count, 20);
+    if (json)
+    {
+        *out << "{\"mem\":{\"address\":" << std::dec << i << ",\"bytes\":[";
+        for (int k = 0; k < c; k++)
+            *out << (k ? "," : "") << (int)ram.readByte(i + k);
+        *out << "]}}" << std::endl;
+        return;
+    }
     while (c--)
-        std::cout << "Memory[" << "0x" << std::hex << i << "] = " << "0x" << (long long)(memory[i++]) << std::endl;
+        *out << "Memory[" << "0x" << std::hex << i << "] = " << "0x" << (long long)(ram.readByte(i++)) << std::endl;
 }
 
 void simulator::showStack()
 {
+    if (json)
+    {
+        bool complete = lineCounter >= lines.size();
+        *out << "{\"stack\":[";
+        for (size_t i = 0; !complete && i < Stack.size(); i++)
+            *out << (i ? "," : "") << "{\"label\":\"" << Stack[i].first << "\",\"line\":" << std::dec << Stack[i].second << '}';
+        *out << "],\"complete\":" << (complete ? "true" : "false") << '}' << std::endl;
+        return;
+    }
     if (lineCounter >= lines.size())
-        std::cout << "Empty Call Stack: Execution complete" << std::endl;
+        *out << "Empty Call Stack: Execution complete" << std::endl;
     else
     {
-        std::cout << "Call Stack:" << std::endl;
+        *out << "Call Stack:" << std::endl;
         for (auto p : Stack)
-            std::cout << std::dec << p.first << ':' << p.second << std::endl;
+            *out << std::dec << p.first << ':' << p.second << std::endl;
     }
 }
 
+long long simulator::getLabelLine(std::string label)
+{
+    auto found = Labels.find(label);
+    return found == Labels.end() ? -1 : found->second.second;
+}
+
 void simulator::addBreakPoint(int lineNumber)
 {
-    breakPoints.insert(lineNumber);
-    std::cout << "Breakpoint set at line " << std::dec << lineNumber << std::endl;
+    if (breakPoints.insert(lineNumber).second && lineNumber < lineToPC.size() && lineToPC[lineNumber] < textEnd)
+    {
+        breakCounts[lineToPC[lineNumber] >> 2]++;
+        breakpointCount++;
+        clearBlocks();
+    }
+    *out << "Breakpoint set at line " << std::dec << lineNumber << std::endl;
 }
 
 void simulator::deleteBreakpoint(int lineNumber)
 {
     if (breakPoints.find(lineNumber) == breakPoints.end())
-        std::cout << "Break Point Doesn't exist at Line number: " << std::dec << lineNumber << std::endl;
+        *out << "Break Point Doesn't exist at Line number: " << std::dec << lineNumber << std::endl;
     else
+    {
         breakPoints.erase(lineNumber);
+        if (lineNumber < lineToPC.size() && lineToPC[lineNumber] < textEnd)
+        {
+            breakCounts[lineToPC[lineNumber] >> 2]--;
+            breakpointCount--;
+            clearBlocks();
+        }
+    }
+}
+
+void simulator::checkWatchpoints(long long address, int size, bool write)
+{
+    // Only accesses touching a page with a watchpoint pay for the list walk
+    long long last = address + size / 8 - 1;
+    if (watchedPages.find(address >> memory::pageBits) == watchedPages.end() && watchedPages.find(last >> memory::pageBits) == watchedPages.end())
+        return;
+
+    for (auto &w : watchpoints)
+        if ((write ? w.write : w.read) && address < w.address + w.length && w.address <= last)
+        {
+            *out << "Watchpoint 0x" << std::hex << w.address << " hit: " << (write ? "write" : "read") << " of " << std::dec << size / 8 << " bytes at 0x" << std::hex << address << ", line " << std::dec << lineOfPC(PC) << std::endl;
+            watchHit = interrupted = true;
+            return;
+        }
+}
+
+bool simulator::stopAtWatchpoint()
+{
+    if (!watchHit)
+        return false;
+    watchHit = false;
+    interrupted = codeModified;
+    *out << "Execution stopped at watchpoint" << std::endl;
+    return true;
+}
+
+void simulator::addWatchpoint(long long address, long long length, bool read, bool write)
+{
+    if (address < 0 || length <= 0 || address + length > ram.size())
+    {
+        *out << "Watchpoint outside memory" << std::endl;
+        return;
+    }
+    watchpoints.push_back({address, length, read, write});
+    for (long long page = address >> memory::pageBits; page <= (address + length - 1) >> memory::pageBits; page++)
+        watchedPages.insert(page);
+    // Native loads and stores would bypass the check
+    clearBlocks();
+    *out << "Watchpoint set at 0x" << std::hex << address << ", " << std::dec << length << " bytes" << std::endl;
+}
+
+void simulator::deleteWatchpoint(long long address)
+{
+    auto found = std::find_if(watchpoints.begin(), watchpoints.end(), [address](const watchpoint &w)
+                              { return w.address == address; });
+    if (found == watchpoints.end())
+    {
+        *out << "Watchpoint Doesn't exist at address: 0x" << std::hex << address << std::endl;
+        return;
+    }
+    watchpoints.erase(found);
+
+    watchedPages.clear();
+    for (auto &w : watchpoints)
+        for (long long page = w.address >> memory::pageBits; page <= (w.address + w.length - 1) >> memory::pageBits; page++)
+            watchedPages.insert(page);
+}
+
+void simulator::takeSnapshot(std::string name)
+{
+    snapshot &s = snapshots[name];
+    memcpy(s.registers, registers, sizeof(registers));
+    s.PC = PC;
+    s.lineCounter = lineCounter;
+    s.error = error;
+    s.Stack = Stack;
+    s.cacheEnabled = cacheEnabled;
+    s.cache = cacheEnabled ? std::make_shared<CACHE>(*cacheSim) : nullptr;
+    s.pages = ram.snapshot();
+    countBlockRuns();
+    s.jitInstructions = jitInstructions;
+    s.interpretedInstructions = interpretedInstructions;
+    s.opCounts = opCounts;
+    s.branchesTaken = branchesTaken;
+    *out << "Snapshot " << name << " taken" << std::endl;
+}
+
+void simulator::restoreSnapshot(std::string name)
+{
+    auto found = snapshots.find(name);
+    if (found == snapshots.end())
+    {
+        *out << "Snapshot Doesn't exist: " << name << std::endl;
+        return;
+    }
+    snapshot &s = found->second;
+
+    // Only pages written since the snapshot can hold different instructions
+    for (long long page : ram.restore(s.pages))
+        if (page << memory::pageBits < textEnd)
+            invalidateCode(page << memory::pageBits, memory::pageSize * 8);
+
+    if (callGraph)
+        chargeCall(retired());
+    memcpy(registers, s.registers, sizeof(registers));
+    PC = s.PC;
+    lineCounter = s.lineCounter;
+    error = s.error;
+    Stack = s.Stack;
+    // Block runs since the snapshot are dropped with the other counts
+    countBlockRuns();
+    jitInstructions = s.jitInstructions;
+    interpretedInstructions = s.interpretedInstructions;
+    opCounts = s.opCounts;
+    branchesTaken = s.branchesTaken;
+    cacheEnabled = s.cacheEnabled;
+    if (s.cache && cacheSim)
+        cacheSim->restore(*s.cache);
+    else if (s.cache)
+        cacheSim = new CACHE(*s.cache);
+    // The call graph carries on from the restored frames
+    if (callGraph)
+    {
+        followStack();
+        callRetired = retired();
+        callMisses = cacheEnabled ? cacheMisses() : 0;
+    }
+    *out << "Restored snapshot " << name << std::endl;
+}
+
+void simulator::setMemorySize(long long size)
+{
+    ram.setSize(size);
+    *out << "Address space set to 0x" << std::hex << size << std::dec << " bytes" << std::endl;
+}
+
+void simulator::printMemoryStats()
+{
+    ram.printStats(*out);
 }
 
 void simulator::enableCache(std::string fileName)
@@ -875,6 +2529,7 @@ void simulator::enableCache(std::string fileName)
     int cacheSize, blockSize, associativity;
     std::string replacementPolicy, writePolicy;
     file >> cacheSize >> blockSize >> associativity >> replacementPolicy >> writePolicy;
+    delete cacheSim;
     cacheSim = new CACHE(cacheSize, blockSize, associativity, replacementPolicy, writePolicy);
     cacheEnabled = true;
 }
@@ -887,17 +2542,23 @@ void simulator::disableCache()
 void simulator::printStatus()
 {
     if (!cacheEnabled)
-        std::cout << "Cache not Enabled" << std::endl;
+        *out << "Cache not Enabled" << std::endl;
     else
     {
-        std::cout << "Cache Enabled" << std::endl;
-        cacheSim->printStatus();
+        *out << "Cache Enabled" << std::endl;
+        cacheSim->printStatus(*out);
     }
 }
 
 void simulator::printStats()
 {
-    cacheSim->printStats();
+    cacheStatistics stats;
+    if (json && getCacheStatistics(stats))
+        *out << std::dec << "{\"cache\":{\"accesses\":" << stats.accesses << ",\"hits\":" << stats.hits << ",\"misses\":" << stats.misses << "}}" << std::endl;
+    else if (json)
+        *out << "{\"cache\":null}" << std::endl;
+    else
+        cacheSim->printStats(*out);
 }
 
 void simulator::invalidateCache()
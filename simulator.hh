@@ -5,74 +5,441 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
 #include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <array>
+#include "decoder.hh"
+#include "jit.hh"
+#include "memory.hh"
+#include "assembly.hh"
 
 class CACHE;
 class simulator
 {
+public:
+    enum executionMode
+    {
+        DECODED,
+        BINARY,
+        BLOCK,
+        JIT
+    };
+
+    struct cacheStatistics
+    {
+        long long accesses;
+        long long hits;
+        long long misses;
+        long long reads;
+        long long writes;
+        long long evictions;
+        long long writebacks;
+    };
+
+    // Counters by name, such as instructions.load or cache.misses
+    typedef std::vector<std::pair<std::string, double>> counterList;
+
+    // Called with the PC and the source tokens of every executed instruction
+    typedef std::function<void(long long PC, const assembly::tokens &line)> traceCallback;
+
 private:
+    // Runs one instruction of a block, moves PC on and keeps x0 at zero.
+    // False when the instruction interrupted the block, by writing to the
+    // text section or hitting a watchpoint.
+    typedef bool (*handler)(simulator &sim, const decoder::instruction &ins);
+
+    // A straight-line run of instructions translated on first execution. The
+    // successor pointers are filled in lazily so that, once a loop has run once,
+    // control moves from block to block without going back to the lookup table.
+    // In JIT mode a block that has run jitThreshold times gets native code for
+    // the first nativeOps instructions.
+    struct block
+    {
+        std::vector<decoder::instruction> ops;
+        std::vector<handler> handlers;
+        long long start;
+        long long end;
+        block *next;
+        block *taken;
+        int executions;
+        int nativeOps;
+        // Times the handlers ran the whole block and the native code ran to
+        // its end. Their operations only reach opCounts when the block is
+        // dropped or the counters are read.
+        long long runs;
+        long long nativeRuns;
+        jit::code native;
+    };
+
     std::string fileName;
-    u_int8_t memory[0x50001];
+    // Where the cache writes its access log, by default derived from fileName
+    std::string outputName;
+    bool outputNamed;
+    std::ostream *out;
+    std::ostream *err;
+    std::ostream discard;
+    std::vector<std::string> errors;
+    traceCallback traceHandler;
+    memory ram;
     long long registers[32];
-    std::vector<std::vector<std::string>> lines;
+    // The loaded file, with the instruction tokens of every line
+    assembly lines;
+    std::vector<decoder::instruction> program;
+    std::vector<long long> pcToLine;
+    std::vector<long long> lineToPC;
+    // Hash of every source line shifted up one bit, with the low bit set for
+    // lines read inside .data. Lets reload tell which lines changed.
+    std::vector<u_int64_t> lineHashes;
+    // The text and data as assembled, which reload starts from. Only kept
+    // after a clean load of a source whose text and data are apart.
+    bool reloadable;
+    std::vector<u_int8_t> assembledText;
+    std::vector<u_int8_t> assembledData;
     long long PC;
     long long MC;
+    static constexpr long long dataStart = 0x10000;
     long long lineCounter;
     bool error;
     std::vector<std::pair<std::string, int>> Stack;
-    std::map<std::string, std::pair<long long, long long>> Labels;
+    std::map<std::string, std::pair<long long, long long>, std::less<>> Labels;
+    // Functions of a loaded executable by address, to name the frames of calls
+    std::unordered_map<long long, std::string_view> symbols;
+    // Calls in an executable follow the calling convention, where jal x0 is
+    // a jump and jalr with a link register a call
+    bool executable;
+    // A branch or jal to a label further down the file, patched once every label is known
+    struct fixup
+    {
+        long long PC;
+        long long line;
+        std::string_view label;
+        int encode;
+        bool jump;
+    };
     std::set<long long> breakPoints;
+    // Breakpoints per instruction, indexed by PC / 4
+    std::vector<int> breakCounts;
+    int breakpointCount;
+    struct watchpoint
+    {
+        long long address;
+        long long length;
+        bool read;
+        bool write;
+    };
+    std::vector<watchpoint> watchpoints;
+    // Pages holding at least one watchpoint, so other accesses skip the list
+    std::unordered_set<long long> watchedPages;
+    // A snapshot shares memory pages with the simulator until one side writes them
+    struct snapshot
+    {
+        long long registers[32];
+        long long PC;
+        long long lineCounter;
+        bool error;
+        std::vector<std::pair<std::string, int>> Stack;
+        bool cacheEnabled;
+        std::shared_ptr<CACHE> cache;
+        memory::pageTable pages;
+        // The counters go back too, so that stats and the instruction limit
+        // only see the restored run
+        long long jitInstructions;
+        long long interpretedInstructions;
+        std::array<long long, decoder::ECALL + 1> opCounts;
+        long long branchesTaken;
+    };
+    std::map<std::string, snapshot> snapshots;
+    bool watchHit;
     bool cacheEnabled;
+    executionMode mode;
+    long long textEnd;
+    std::unordered_map<long long, block> blocks;
+    // Blocks by the low bits of their start, checked before the table. Saves
+    // most lookups after a jalr, whose target changes from run to run.
+    std::array<block *, 1024> recentBlocks;
+    bool codeModified;
+    // Set when the current instruction needs run to look at codeModified or watchHit
+    bool interrupted;
+    int jitThreshold;
+    long long jitInstructions;
+    long long interpretedInstructions;
+    long long instructionLimit;
+    // Retired instructions by operation, and the branches among them that
+    // were taken. Native blocks add theirs when they return.
+    std::array<long long, decoder::ECALL + 1> opCounts;
+    long long branchesTaken;
+    // Host time of the last load and of every run since
+    double assembleSeconds;
+    double runSeconds;
+    // Where the counters are written as JSON when the simulator goes away
+    std::string counterDumpName;
+    bool running;
+    bool echo;
+    bool tracing;
+    // regs, mem, show-stack and cache stats print one JSON object per line
+    bool json;
+    // Executions and D-cache misses of every instruction, indexed by PC / 4,
+    // counted while profiling
+    bool profiling;
+    std::vector<long long> profileCounts;
+    std::vector<long long> profileMisses;
+    // One function reached through one chain of calls, with what ran in it
+    // outside of the calls it made
+    struct callNode
+    {
+        std::string name;
+        int parent;
+        long long calls;
+        long long instructions;
+        long long misses;
+        std::unordered_map<std::string, int> children;
+    };
+    // The call graph follows Stack, callPath holds the node of every frame
+    bool callGraph;
+    std::vector<callNode> callNodes;
+    std::vector<int> callPath;
+    // Retired instructions and cache misses already charged to a node
+    long long callRetired;
+    long long callMisses;
+    std::ofstream traceFile;
+    std::string traceBuffer;
+    static const size_t traceChunk = 1 << 20;
     CACHE *cacheSim;
 
     void reset();
 
     void printError(std::string s);
 
-    void checkProperLabel(std::string s);
+    void checkProperLabel(std::string_view s);
+
+    long long loadData(long long address, int size, bool isSigned);
+
+    void storeData(long long data, long long address, int size);
+
+    long long solveImmediateSigned(std::string_view s, int max);
+
+    long long solveImmediateNonNegative(std::string_view s, int max);
+
+    long long solveDataFromDataSection(std::string_view s, int max);
+
+    int solveRegister(std::string_view s);
+
+    int encodeInstruction(assembly::tokens v, std::vector<fixup> &fixups);
+
+    // Stores the label and instruction of a line read in .text
+    void assembleLine(std::string_view line, std::vector<fixup> &fixups);
+
+    void resolveFixups(const std::vector<fixup> &fixups);
+
+    void storeInstructions();
+
+    // Assembles only the lines of the source that changed since the last
+    // load and moves the rest. False when the change needs a full load.
+    bool assembleChanges();
+
+    // An object file holds the assembled text and data, the labels and where
+    // the instruction of every line is in the source. It is only used while
+    // the hash of the source matches.
+    void saveObject(std::string objectName, u_int64_t hash);
+
+    bool loadObject(std::string objectName, u_int64_t hash);
+
+    // Maps the segments of the ELF executable in lines into memory, gives
+    // every instruction word of the text a line of its own and returns the
+    // entry point
+    long long loadExecutable();
+
+    // Resets for a load and returns whether the cache was enabled
+    bool beginLoad();
+
+    void finishLoad(bool cache, long long entry);
+
+    void assemble();
+
+    void decodeProgram();
+
+    u_int32_t fetchInstruction(long long PC);
+
+    long long lineOfPC(long long PC);
+
+    bool isInText(long long PC);
+
+    void invalidateCode(long long address, int size);
+
+    static handler handlerFor(const decoder::instruction &ins);
+
+    block *findBlock(long long PC);
+
+    // Adds the operations of every complete block run to opCounts
+    void countBlockRuns();
+
+    void clearBlocks();
+
+    void traceInstruction(long long PC);
+
+    void flushTrace();
 
-    long long loadData(int index, int size, bool isSigned);
+    long long cacheMisses();
 
-    void storeData(long long data, int index, int size);
+    // The node for a call of name from parent, added on the first call
+    int callChild(int parent, const std::string &name);
 
-    long long solveImmediateSigned(std::string s, int max);
+    // Charges everything retired up to retiredNow to the innermost frame
+    void chargeCall(long long retiredNow);
 
-    long long solveImmediateNonNegative(std::string s, int max);
+    // Rebuilds callPath from Stack, without counting calls
+    void followStack();
 
-    long long solveDataFromDataSection(std::string s, int max);
+    void enterCall();
 
-    int solveRegister(std::string s);
+    void leaveCall();
 
-    void preprocess(std::string s);
+    void updateStackTop(long long line, decoder::operation op);
 
-    void storeInstructions(std::string fileName);
+    void pushFrame(long long target);
 
-    long long findLineNumberWrtPC(long long PC);
+    void systemCall(long long &nextPC);
+
+    void interpret(bool step, long long budget);
+
+    void runBlocks(long long budget);
+
+    long long retired();
+
+    void checkWatchpoints(long long address, int size, bool write);
+
+    bool stopAtWatchpoint();
+
+    void execute(const decoder::instruction &ins);
 
 public:
     friend class CACHE;
 
-    simulator()
+    simulator() : discard(nullptr)
     {
+        out = &std::cout;
+        err = &std::cerr;
+        outputNamed = false;
+        cacheSim = nullptr;
         cacheEnabled = false;
+        running = false;
+        watchHit = false;
+        instructionLimit = 0;
+        mode = DECODED;
+        jitThreshold = 16;
+        json = false;
+        profiling = false;
+        callGraph = false;
+        echo = tracing = false;
+        callRetired = callMisses = 0;
+        assembleSeconds = 0;
+        // The state of an empty program until the first load
+        reset();
     }
     
-    void run(bool step);
+    ~simulator();
+
+    void run(bool step, bool quiet, long long count);
 
     void load(std::string fileName);
 
+    // Loads the same file again, assembling only what changed since the last
+    // load. Breakpoints and watchpoints are kept.
+    void reload();
+
+    void setOutput(std::ostream &out, std::ostream &err);
+
+    void discardOutput();
+
+    void setTraceCallback(traceCallback callback);
+
+    // Results for callers that use the simulator as a library
+    std::array<long long, 32> getRegisters();
+
+    long long getPC();
+
+    long long getRetired();
+
+    bool isFinished();
+
+    const std::vector<std::string> &getErrors();
+
+    std::vector<std::pair<std::string, int>> getStack();
+
+    u_int8_t getMemory(long long address);
+
+    bool getCacheStatistics(cacheStatistics &stats);
+
+    counterList getCounters();
+
+    void printCounters();
+
+    // Writes the counters as JSON to fileName on exit
+    void setCounterDump(std::string fileName);
+
+    void setOutputName(std::string name);
+
+    void setExecutionMode(executionMode mode);
+
+    void setInstructionLimit(long long limit);
+
+    void startTrace(std::string fileName);
+
+    void stopTrace();
+
+    void setJitThreshold(int threshold);
+
+    void printJitStats();
+
+    void setJsonOutput(bool json);
+
+    // Turning profiling on starts the counts again, turning it off keeps
+    // them for the report
+    void setProfiling(bool on);
+
+    // Prints the executions and cache misses of every label and of the
+    // hottest instructions, and writes each source line with its counts to
+    // listingName, by default the file name with .prof
+    void printProfile(std::string listingName);
+
+    // Like setProfiling, for the call graph
+    void setCallGraph(bool on);
+
+    // Prints calls, instructions and cache misses of every function with and
+    // without the functions it calls, and writes the call stacks in collapsed
+    // form for flame graphs to foldedName, by default the file name with .folded
+    void printCallGraph(std::string foldedName);
+
     void printRegisters();
 
     void printMemory(std::string index, std::string count);
 
     void showStack();
 
+    // The line of a label or symbol, -1 when there is none
+    long long getLabelLine(std::string label);
+
     void addBreakPoint(int lineNumber);
 
     void deleteBreakpoint(int lineNumber);
 
+    void addWatchpoint(long long address, long long length, bool read, bool write);
+
+    void deleteWatchpoint(long long address);
+
+    void takeSnapshot(std::string name);
+
+    void restoreSnapshot(std::string name);
+
+    void setMemorySize(long long size);
+
+    void printMemoryStats();
+
     void enableCache(std::string fileName);
 
     void disableCache();
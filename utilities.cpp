@@ -1,12 +1,5 @@
 #include "utilities.hh"
-
-void utilities::spiltLineIntoWords(std::string s, std::vector<std::string> &v)
-{
-    std::stringstream ss(s);
-    std::string word;
-    while (ss >> word)
-        v.push_back(word);
-}
+#include <charconv>
 
 bool utilities::checkIfValueIsInBetween(char c, char min, char max)
 {
@@ -15,7 +8,7 @@ bool utilities::checkIfValueIsInBetween(char c, char min, char max)
     return false;
 }
 
-bool utilities::checkBase10(std::string s)
+bool utilities::checkBase10(std::string_view s)
 {
     for (char c : s)
         if (!utilities::checkIfValueIsInBetween(c, '0', '9'))
@@ -23,7 +16,7 @@ bool utilities::checkBase10(std::string s)
     return true;
 }
 
-bool utilities::checkBase16(std::string s)
+bool utilities::checkBase16(std::string_view s)
 {
     for (char c : s)
         if (!utilities::checkIfValueIsInBetween(c, '0', '9') && !utilities::checkIfValueIsInBetween(c, 'a', 'f'))
@@ -31,23 +24,43 @@ bool utilities::checkBase16(std::string s)
     return true;
 }
 
-void utilities::format(std::string &s)
+// Decimal or 0x prefixed hexadecimal, -1 if s is neither
+long long utilities::parseAddress(std::string s)
 {
-    long long index = 0;
-    while (s[index] == ' ')
-        index++;
-    s = s.substr(index);
-
-    index = s.size() - 1;
-    while (s[index] == ' ')
-        index--;
-    s = s.substr(0, index + 1);
+    if (s.size() > 2 && s.size() <= 18 && s[0] == '0' && s[1] == 'x' && utilities::checkBase16(s.substr(2)))
+        return stoll(s, nullptr, 16);
+    if (!s.empty() && s.size() <= 18 && utilities::checkBase10(s))
+        return stoll(s);
+    return -1;
+}
 
-    index = s.find(";");
-    if (index != std::string::npos)
-        s = s.substr(0, index);
+// Decimal or 0x prefixed hexadecimal, either one optionally negative
+bool utilities::isInteger(std::string_view s)
+{
+    if (!s.empty() && s[0] == '-')
+        s.remove_prefix(1);
+    if (s.size() > 2 && s[0] == '0' && s[1] == 'x')
+        return utilities::checkBase16(s.substr(2));
+    return !s.empty() && utilities::checkBase10(s);
+}
 
-    for (int i = 0; i < s.size(); i++)
-        if (s[i] == ',')
-            s[i] = ' ';
-}
\ No newline at end of file
+// Value of an integer accepted by isInteger. Like stoull a negative number
+// wraps around, false if the digits do not fit in 64 bits.
+bool utilities::parseInteger(std::string_view s, long long &value)
+{
+    bool negative = !s.empty() && s[0] == '-';
+    if (negative)
+        s.remove_prefix(1);
+    int base = 10;
+    if (s.size() > 2 && s[0] == '0' && s[1] == 'x')
+    {
+        s.remove_prefix(2);
+        base = 16;
+    }
+    unsigned long long magnitude;
+    auto result = std::from_chars(s.data(), s.data() + s.size(), magnitude, base);
+    if (result.ec != std::errc() || result.ptr != s.data() + s.size())
+        return false;
+    value = negative ? -magnitude : magnitude;
+    return true;
+}
@@ -2,16 +2,18 @@
 #define UTILITIES_GUARD
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <sstream>
 
 namespace utilities
 {
-    void spiltLineIntoWords(std::string s, std::vector<std::string> &v);
     bool checkIfValueIsInBetween(char c, char min, char max);
-    bool checkBase10(std::string s);
-    bool checkBase16(std::string s);
-    void format(std::string &s);
+    bool checkBase10(std::string_view s);
+    bool checkBase16(std::string_view s);
+    long long parseAddress(std::string s);
+    bool isInteger(std::string_view s);
+    bool parseInteger(std::string_view s, long long &value);
 }
 
 #endif
\ No newline at end of file